@@ -0,0 +1,86 @@
+#ifndef __CaptureReactor_H__
+#define __CaptureReactor_H__
+
+#include "Capture/CaptureWorker.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs many RtspCaptureThread sessions on two small fixed pools of threads
+// instead of one QThread per camera:
+//  - connect threads drive the sessions that are not streaming (disabled,
+//    reconnect backoff, waiting for a connect slot, the blocking RTSP
+//    open + probe, and cameras that went quiet);
+//  - I/O threads only read the sessions that are streaming.
+// A session moves to the least loaded I/O thread once it delivers packets
+// and back to a connect thread when its stream fails, is disabled, or has
+// nothing to read for a read slice (kReadSliceMs), so a dead, slow or
+// silent camera never holds an I/O thread for longer than that slice.
+// Each thread steps its sessions round-robin and sleeps until the earliest
+// one asks to be serviced again; a session's wakeup only wakes the thread
+// that owns it.
+//
+// FFmpeg's RTSP demuxer has no readiness API: a read on an I/O thread
+// still blocks until the session's next packet or the end of its slice,
+// and the sessions behind it on that thread wait meanwhile.
+class CaptureReactor {
+public:
+    // ioThreads <= 0 picks min(idealThreadCount, number of sessions) at
+    // start(); connectThreads <= 0 picks kDefaultConnectThreads
+    explicit CaptureReactor(int ioThreads = 0, int connectThreads = 0);
+    ~CaptureReactor();
+
+    // Must be called before start(). The reactor does not take ownership;
+    // the session's wakeSession() reaches the reactor until stop().
+    void addSession(RtspCaptureThread *session);
+
+    void start();
+    void stop();
+
+    int ioThreadCount() const { return m_ioThreads; }
+
+    static constexpr int kDefaultConnectThreads = 8;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Slot {
+        RtspCaptureThread *session{nullptr};
+        clock::time_point  due;
+    };
+
+    struct Worker {
+        int                             index{0};
+        bool                            connector{false};
+        std::thread                     thread;
+        std::vector<Slot>               entries;
+        std::condition_variable         cond;
+        std::vector<RtspCaptureThread*> inbox; // m_mutex, handed over
+        std::vector<RtspCaptureThread*> woken; // m_mutex, due right away
+        std::atomic<int>                load{0}; // entries + inbox
+    };
+
+    void workerLoop(Worker *w);
+    // Give a session to the least loaded thread of the other pool
+    void handOff(RtspCaptureThread *session, bool toConnector);
+    // Cut the owning thread's wait short for this session
+    void wakeSession(RtspCaptureThread *session);
+
+    int                                   m_requestedThreads{0};
+    int                                   m_requestedConnectThreads{0};
+    int                                   m_ioThreads{0};
+    std::vector<RtspCaptureThread*>       m_sessions;
+    std::vector<std::unique_ptr<Worker>>  m_workers; // connect threads first
+    std::atomic_bool                      m_running{false};
+
+    std::mutex                                        m_mutex;
+    std::unordered_map<RtspCaptureThread*, Worker*>   m_owner; // m_mutex
+
+    static constexpr int kMaxIdleWaitMs = 100;
+};
+
+#endif /* __CaptureReactor_H__ */
@@ -3,23 +3,73 @@
 #define __CaptureWorker_H__
 
 #include "Utils.hpp"
+#include "Recording/PacketQueue.hpp"
+#include "Codec/H26xBitstream.hpp"
+#include "Display/FrameMailbox.hpp"
+#include "Display/FramePool.hpp"
+#include "Capture/DecoderBudget.hpp"
+#include "Capture/StreamProbeCache.hpp"
+#include "Capture/ConnectionScheduler.hpp"
 #include <QDebug>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+
+// What a capture session produces. Dual-stream cameras (preview_url) run a
+// RECORD session on the main stream and a PREVIEW session on the substream.
+enum CaptureRole {
+    CAPTURE_ROLE_FULL    = 0, // packets for the recorder + decoded frames
+    CAPTURE_ROLE_RECORD  = 1, // packets only, never decodes
+    CAPTURE_ROLE_PREVIEW = 2  // decoded frames only, packets are not forwarded
+};
 
 class RtspCaptureThread : public QThread {
     Q_OBJECT
 public:
     RtspCaptureThread(const QString &streamId,
                       const QString &url,
-                      QObject *parent = nullptr);
+                      QObject *parent = nullptr,
+                      CaptureRole role = CAPTURE_ROLE_FULL);
     ~RtspCaptureThread() override;
 
+    // Also aborts a blocking FFmpeg open/read (interrupt callback)
     void requestStop() {
         m_abort.storeRelease(1);
+        wakeSession();
+    }
+
+    // Cut the current idle/retry wait short: run()'s in thread mode, the
+    // driving reactor's (wake handler) in reactor mode
+    void wakeSession();
+
+    // Reactor mode: set by CaptureReactor::addSession()
+    void setWakeHandler(std::function<void()> handler)
+    {
+        m_wakeHandler = std::move(handler);
+    }
+
+    bool isStopRequested() const {
+        return m_abort.loadAcquire() != 0;
     }
 
+    // Input open and delivering packets (not quiet past a read slice). Only
+    // meaningful on the thread that drives step().
+    bool isStreaming() const {
+        return m_fmtCtx && m_online && !m_readQuiet;
+    }
+
+    // The display counts as one frame consumer
     void setWithUserInterface(bool c)
     {
+        if (c == m_userInterface)
+            return;
         m_userInterface = c;
+        if (c)
+            attachFrameConsumer();
+        else
+            detachFrameConsumer();
     }
 
     void setVerboseLevel(int c)
@@ -27,6 +77,132 @@ public:
         mVerboseLevel = c;
     }
 
+    // Reactor mode: ask the demuxer for AVFMT_FLAG_NONBLOCK reads. Demuxers
+    // that honour it hand the I/O thread back with EAGAIN when no data is
+    // pending; the RTSP demuxer ignores it, so a read is also cut after
+    // kReadSliceMs without data and the session marked quiet (its reactor
+    // then waits for the next packet on a connect thread).
+    void setNonBlockingRead(bool c)
+    {
+        m_nonBlockingRead = c;
+    }
+
+    // Size of the frames emitted by frameReady (display grid cell). The
+    // decoded picture is converted and downscaled to it in one sws_scale
+    // pass. 0x0 = source resolution. Safe from any thread.
+    void setFrameTargetSize(int w, int h)
+    {
+        const quint32 packed = (w > 0 && h > 0)
+                ? (static_cast<quint32>(qMin(w, 0xffff)) << 16) | static_cast<quint32>(qMin(h, 0xffff))
+                : 0u;
+        m_frameTarget.storeRelease(packed);
+    }
+
+    // Decoder threading (stream config). threads > 0 is fixed; 0 = granted by
+    // the decoder budget if one is set, else 1. Must be set before the
+    // session starts.
+    void setDecoderThreading(int threads, int threadType)
+    {
+        m_decoderThreads    = threads;
+        m_decoderThreadType = threadType;
+    }
+
+    // Display decode mode (PreviewDecodeMode); set before start()
+    void setPreviewDecodeMode(int mode) { m_previewDecode = mode; }
+
+    // Joined while the decoder is open (auto decoder_threads only)
+    void setDecoderBudget(std::shared_ptr<DecoderBudget> budget)
+    {
+        m_decoderBudget = std::move(budget);
+    }
+
+    // Reuse the last known stream parameters on (re)connect instead of
+    // avformat_find_stream_info(). Must be set before the session starts.
+    void setProbeCache(std::shared_ptr<StreamProbeCache> cache)
+    {
+        m_probeCache = std::move(cache);
+    }
+
+    // Global connect admission (N concurrent opens, by priority). Must be set
+    // before the session starts.
+    void setConnectionScheduler(std::shared_ptr<ConnectionScheduler> scheduler, int priority)
+    {
+        m_connectScheduler = std::move(scheduler);
+        if (m_connectScheduler)
+            m_connectScheduler->registerStream(m_sessionKey, priority, [this]() { wakeSession(); });
+    }
+
+    // Preview frames go to this latest-wins slot when set, otherwise through
+    // frameReady. Must be set before the session starts.
+    void setFrameMailbox(std::shared_ptr<FrameMailbox> m)
+    {
+        m_frameMailbox = std::move(m);
+    }
+
+    // Packets go to this queue when set, otherwise through videoPacketReady.
+    // Must be set before the session starts.
+    void setPacketQueue(std::shared_ptr<PacketQueue> q)
+    {
+        m_packetQueue = std::move(q);
+    }
+
+    const QString &streamId() const { return m_streamId; }
+    CaptureRole role() const { return m_role; }
+
+    // Preview buffer pool counters for /stats (atomics, any thread)
+    sl::json framePoolStatsJson() const { return m_framePool.statsJson(); }
+
+    // Connect timings for /stats (atomics, any thread). -1 = not yet.
+    sl::json connectStatsJson() const
+    {
+        sl::json j;
+        j["opens"]                   = m_opens.loadAcquire();
+        j["full_probes"]             = m_fullProbes.loadAcquire();
+        j["cached_probes"]           = m_probesSkipped.loadAcquire();
+        j["last_open_ms"]            = m_lastOpenMs.loadAcquire();
+        j["last_probe_ms"]           = m_lastProbeMs.loadAcquire();
+        j["last_first_packet_ms"]    = m_lastFirstPacketMs.loadAcquire();
+        j["startup_first_packet_ms"] = m_startupFirstPacketMs.loadAcquire();
+        j["quiet_reads"]             = m_quietReads.loadAcquire();
+        return j;
+    }
+
+    // Decoder threading and measured cost for /stats (atomics, any thread)
+    sl::json decoderStatsJson() const
+    {
+        sl::json j;
+        j["threads"]       = m_activeDecoderThreads.loadAcquire(); // 0 = decoder closed
+        j["threads_mode"]  = m_decoderThreads > 0 ? "fixed" : "auto";
+        j["decode_us_avg"] = m_decodeUsAvg.loadAcquire();
+        j["load"]          = m_decodeLoadMilli.loadAcquire() / 1000.0;
+        j["preview_decode"] = m_previewDecode == PREVIEW_DECODE_KEY    ? "key"
+                            : m_previewDecode == PREVIEW_DECODE_NONREF ? "nonref" : "all";
+        j["packets_not_decoded"] = m_packetsNotDecoded.loadAcquire(); // key mode
+        return j;
+    }
+
+    // Bitstream inspection counters for /stats (atomics, any thread)
+    sl::json bitstreamStatsJson() const
+    {
+        sl::json j;
+        j["layout"]            = nalLayoutName(m_bitstream.layout());
+        j["packets"]           = m_bitstream.packets();
+        j["keyframes"]         = m_bitstream.keyframes();
+        j["param_set_changes"] = m_bitstream.parameterSetChanges();
+        j["inspect_ns_avg"]    = m_bitstream.avgInspectNs();
+        return j;
+    }
+
+    // Session state machine. In thread mode run() drives these itself; in
+    // reactor mode CaptureReactor threads drive many sessions at once (open
+    // and reconnect on connect threads, reads on I/O threads).
+    // prepareSession()/finishSession() bracket the session, step() does one
+    // bounded unit of work and returns how long (ms) the session can be left
+    // alone before the next step (0 = call again right away).
+    bool prepareSession();
+    int  step();
+    void finishSession();
+
 signals:
     // For recorder
     void streamInfoReady(const StreamInfo &info);
@@ -47,31 +223,143 @@ public slots:
     void onStreamStartRequested(const QString &streamId);
     void onStreamStopRequested(const QString &streamId);
 
+    // Frame consumers (display, analytics, ...). The decoder is only opened
+    // while at least one is attached; otherwise the session is packet-only
+    // and just forwards packets to the recorder. Safe from any thread.
+    void attachFrameConsumer() { m_frameConsumers.fetchAndAddOrdered(1); }
+    void detachFrameConsumer() { m_frameConsumers.fetchAndAddOrdered(-1); }
+
 private:
+    static int interruptCallback(void *opaque);
+    bool applyCachedProbe(AVStream *vs, const StreamProbeCache::Entry &cached);
+    void storeProbeCache();
+    QByteArray currentExtradata() const;
+    int  nextRetryDelayMs();
     bool openInput();
     void closeInput();
+    int  readPacket();
+    bool openDecoder();
+    void closeDecoder();
+    void reviewDecoderThreads();
+    void emitStreamInfo(int width, int height);
+    void setOnline(bool online);
+    cv::Size frameOutputSize() const;
+    void publishFrame(const cv::Mat &frame);
     cv::Mat makeNoSignalFrame(int w, int h,QString);
 
 private:
+    using clock = std::chrono::steady_clock;
+
     QString m_streamId;
     QString m_url;
+    CaptureRole m_role;
+    QString m_sessionKey; // streamId, or streamId + "@preview" (caches, scheduler, budget)
 
     AVFormatContext *m_fmtCtx{nullptr};
     AVCodecContext  *m_codecCtx{nullptr};
     SwsContext      *m_swsCtx{nullptr};
     int              m_videoStreamIndex{-1};
 
+    // SPS size, keyframe and parameter-set tracking without a decoder
+    H26xBitstreamParser m_bitstream;
+    bool             m_paramSetsChanged{false}; // codecpar extradata is stale
+    bool             m_decoderFailed{false};
+
+    // Decoder threading
+    int              m_decoderThreads{0};
+    int              m_decoderThreadType{DECODER_THREAD_AUTO};
+    int              m_previewDecode{PREVIEW_DECODE_ALL};
+    QAtomicInteger<quint64> m_packetsNotDecoded{0};
+    std::shared_ptr<DecoderBudget> m_decoderBudget;
+    bool             m_inDecoderBudget{false}; // registered while the decoder is open
+    QAtomicInteger<int> m_activeDecoderThreads{0};
+    bool             m_decoderReopenPending{false};
+    int              m_shrinkVotes{0};
+
+    // Decode cost measurement (reviewed every kDecoderReviewMs)
+    int64_t          m_decodeNs{0};
+    int              m_decodedFrames{0};
+    double           m_frameIntervalSec{0.0};
+    double           m_lastPtsSec{0.0};
+    QAtomicInteger<int> m_decodeUsAvg{0};
+    QAtomicInteger<int> m_decodeLoadMilli{0};
+
+    AVPacket        *m_pkt{nullptr};
+    AVFrame         *m_frame{nullptr};
+
     int              m_width{640};
     int              m_height{480};
     AVPixelFormat    m_srcPixFmt{AV_PIX_FMT_NONE};
     AVPixelFormat    m_dstPixFmt{AV_PIX_FMT_BGR24};
+    int              m_swsDstWidth{0};  // output size of m_swsCtx
+    int              m_swsDstHeight{0};
+    QAtomicInteger<quint32> m_frameTarget{0}; // (w << 16) | h, 0 = source size
+    int              m_infoWidth{0};   // size last advertised in StreamInfo
+    int              m_infoHeight{0};
 
     QAtomicInteger<int> m_abort{0};
     bool           m_online{false};
     bool           m_userInterface{false};
+    QAtomicInteger<int> m_frameConsumers{0};
+    bool           m_nonBlockingRead{false};
+    bool           m_readQuiet{false}; // read slice ran out, waiting off the I/O threads
 
     QAtomicInteger<int> m_enableStreaming{0}; // 1=enabled, 0=disabled
 
+    std::shared_ptr<PacketQueue> m_packetQueue;
+    std::shared_ptr<FrameMailbox> m_frameMailbox;
+    FramePool        m_framePool;   // preview (BGR) buffers, capture thread only
+
+    // Reconnect state (replaces the old blocking 5 s wait loop)
+    cv::Mat            m_noSignal;
+    bool               m_retryPending{false};
+    clock::time_point  m_retryAt;
+    clock::time_point  m_lastNoSignalEmit;
+    clock::time_point  m_lastDecoderReview;
+    // Connect / probe timings
+    std::shared_ptr<StreamProbeCache> m_probeCache;
+    bool               m_probeSkipped{false};    // current session uses cached parameters
+    bool               m_probeCacheDirty{false}; // cache entry lacks extradata or is outdated
+    bool               m_gotFirstPacket{false};
+    std::shared_ptr<ConnectionScheduler> m_connectScheduler;
+    bool               m_waitingAdmission{false};
+    clock::time_point  m_openStartedAt;
+    clock::time_point  m_firstOpenAt;
+    QAtomicInteger<int> m_opens{0};
+    QAtomicInteger<int> m_fullProbes{0};
+    QAtomicInteger<int> m_probesSkipped{0};
+    QAtomicInteger<int> m_lastOpenMs{-1};
+    QAtomicInteger<int> m_lastProbeMs{-1};
+    QAtomicInteger<int> m_lastFirstPacketMs{-1};
+    QAtomicInteger<int> m_startupFirstPacketMs{-1};
+    QAtomicInteger<quint64> m_quietReads{0};
+
+    int                m_retryAttempt{0};   // consecutive failed opens (backoff exponent)
+    std::mt19937       m_rng;               // retry jitter
+
+    // FFmpeg I/O deadline checked by interruptCallback (capture thread only,
+    // epoch = none) and the time of the last packet (stall detection)
+    clock::time_point  m_ioDeadline;
+    clock::time_point  m_lastPacketAt;
+
+    // run() idle wait, woken by wakeSession()
+    std::mutex              m_sleepMutex;
+    std::condition_variable m_sleepCond;
+    bool                    m_wakePending{false};
+    std::function<void()>   m_wakeHandler;
+
+    static constexpr int kIdlePollMs     = 100;  // streaming disabled
+    static constexpr int kRetryMinMs     = 1000;  // first reconnect delay (then x2 per failure)
+    static constexpr int kRetryMaxMs     = 30000; // reconnect delay cap
+    static constexpr int kOpenTimeoutMs  = 10000; // open / probe deadline
+    static constexpr int kStallTimeoutMs = 5000;  // no packet for this long => reconnect
+    static constexpr int kAdmissionPollMs = 1000; // safety re-check while waiting for a connect slot (woken on release)
+    static constexpr int kNoSignalEmitMs = 200;  // NO SIGNAL frame rate while waiting (5 fps)
+    static constexpr int kDecoderReviewMs = 2000; // decode load report / thread grant check
+    static constexpr int kShrinkReviews   = 3;    // consecutive reviews before giving threads back
+    static constexpr int kNonBlockPollMs = 2;    // demuxer returned EAGAIN (reactor mode)
+    static constexpr int kReadSliceMs    = 250;  // longest read on a shared I/O thread (reactor mode)
+
     QMutex guard;
 
     int mVerboseLevel = 0;
@@ -0,0 +1,65 @@
+#ifndef __ConnectionScheduler_H__
+#define __ConnectionScheduler_H__
+
+#include "Utils.hpp"
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Global admission control for RTSP connects (handshake + probe). At most
+// maxConcurrent sessions open at the same time; waiting sessions are
+// admitted by priority (higher first), then by waiting time: a waiter gets
+// in when fewer waiters rank above it than there are free slots. Sessions
+// call tryAcquire() from their own step() so this works for both capture
+// engines without blocking a thread, and are woken through their wake
+// callback when a slot frees up for them. Thread-safe.
+class ConnectionScheduler {
+public:
+    // maxConcurrent <= 0 = unlimited (admission order and stats only)
+    explicit ConnectionScheduler(int maxConcurrent);
+
+    // wake is called (from any thread, no lock held) when the stream should
+    // call tryAcquire() again
+    void registerStream(const QString &streamId, int priority, std::function<void()> wake = {});
+
+    // True when the session may open now; it must then call release() once
+    // the open attempt is over (success or failure).
+    bool tryAcquire(const QString &streamId);
+    void release(const QString &streamId);
+    // Session no longer wants to connect (stream disabled, shutdown)
+    void cancel(const QString &streamId);
+
+    sl::json statsJson() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct StreamState {
+        std::string       id;
+        int               priority{0};
+        bool              waiting{false};
+        bool              active{false};
+        clock::time_point waitingSince;
+        int64_t           lastWaitMs{-1};
+        uint64_t          admissions{0};
+        std::function<void()> wake;
+    };
+
+    StreamState *find(const std::string &id); // m_mutex held
+    // Waiters that rank above s (m_mutex held)
+    int  waitersAbove(const StreamState &s) const;
+    int  freeSlots() const; // m_mutex held, INT_MAX = unlimited
+    // Wake callbacks of the waiters that tryAcquire() would admit now
+    std::vector<std::function<void()>> admissibleWakes() const; // m_mutex held
+
+    int                      m_maxConcurrent;
+    mutable std::mutex       m_mutex;
+    std::vector<StreamState> m_streams;
+    int                      m_active{0};
+    uint64_t                 m_admitted{0};
+    int64_t                  m_maxWaitMs{0};
+};
+
+#endif /* __ConnectionScheduler_H__ */
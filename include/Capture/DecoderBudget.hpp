@@ -0,0 +1,51 @@
+#ifndef __DecoderBudget_H__
+#define __DecoderBudget_H__
+
+#include "Utils.hpp"
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Global decoder core budget shared by the capture sessions whose
+// decoder_threads is "auto". Only sessions with an open decoder take part.
+// Each one periodically reports its measured decode load (decode time per
+// frame / frame interval, in cores); the budget gives every session one
+// thread and hands the cores the single threads leave idle to the sessions
+// that cannot keep up with one (typically 4K/8K cameras).
+class DecoderBudget {
+public:
+    // cores <= 0 uses QThread::idealThreadCount()
+    explicit DecoderBudget(int cores = 0);
+
+    // While the stream's decoder is open. load = last measured load, if any.
+    void registerStream(const QString &streamId, double load = 0.0);
+    void unregisterStream(const QString &streamId);
+
+    // Measured load in cores (1.0 = one core fully busy decoding). Returns
+    // the thread count currently granted to the stream.
+    int report(const QString &streamId, double load);
+
+    int granted(const QString &streamId) const;
+    int cores() const { return m_cores; }
+
+    sl::json statsJson() const;
+
+    // A stream gets more threads until its load per thread drops below this
+    static constexpr double kTargetLoadPerThread = 0.7;
+    static constexpr int    kMaxThreadsPerStream = 16;
+
+private:
+    struct Entry {
+        std::string id;
+        double      load{0.0};
+        int         threads{1};
+    };
+
+    void rebalance(); // m_mutex held
+
+    int                m_cores;
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+};
+
+#endif /* __DecoderBudget_H__ */
@@ -0,0 +1,58 @@
+#ifndef __StreamProbeCache_H__
+#define __StreamProbeCache_H__
+
+#include "Utils.hpp"
+#include <QSet>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Last known video stream parameters per camera, so that reconnects and
+// restarts can skip avformat_find_stream_info(). Kept in memory and, when a
+// folder is configured, as one small JSON file per stream that survives a
+// restart. Thread-safe (capture sessions share one instance). The files are
+// written and removed by a thread of the cache: store() and invalidate() only
+// touch memory, so the capture read path never waits for the disk.
+class StreamProbeCache {
+public:
+    struct Entry {
+        QString    url;
+        AVCodecID  codecId{AV_CODEC_ID_NONE};
+        int        width{0};
+        int        height{0};
+        AVRational timeBase{0, 1};
+        QByteArray extradata;
+    };
+
+    // folder empty = memory only
+    explicit StreamProbeCache(const QString &folder = QString());
+    ~StreamProbeCache(); // writes what is still pending
+
+    StreamProbeCache(const StreamProbeCache &) = delete;
+    StreamProbeCache &operator=(const StreamProbeCache &) = delete;
+
+    // Entry for this stream if one exists for the same URL
+    bool lookup(const QString &streamId, const QString &url, Entry &out);
+    void store(const QString &streamId, const Entry &entry);
+    // The cached parameters turned out to be wrong: forget them (memory + disk)
+    void invalidate(const QString &streamId);
+
+    const QString &folder() const { return m_folder; }
+
+private:
+    QString filePath(const QString &streamId) const;
+    bool    loadFromDisk(const QString &streamId, Entry &out) const;
+    void    saveToDisk(const QString &streamId, const Entry &entry) const;
+    void    writerLoop();
+
+    QString                 m_folder;
+    std::mutex              m_mutex;
+    QHash<QString, Entry>   m_entries;
+    QSet<QString>           m_pending;  // file to write (entry) or remove (no entry)
+    QString                 m_writing;  // being written or removed
+    std::condition_variable m_pendingCond;
+    bool                    m_stopping{false};
+    std::thread             m_writer;   // only with a folder
+};
+
+#endif /* __StreamProbeCache_H__ */
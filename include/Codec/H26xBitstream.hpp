@@ -0,0 +1,181 @@
+
+#ifndef __H26xBitstream_H__
+#define __H26xBitstream_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// Cheap H.264 / H.265 bitstream inspection without a decoder: NAL unit
+// iteration (Annex B or length-prefixed AVCC/HVCC), SPS picture size,
+// keyframe (IDR/IRAP) detection and parameter-set change tracking.
+
+enum NalLayout {
+    NAL_LAYOUT_UNKNOWN = 0,
+    NAL_LAYOUT_ANNEXB  = 1, // 00 00 01 start codes
+    NAL_LAYOUT_AVCC    = 2  // big-endian length prefix (avcC / hvcC)
+};
+
+const char *nalLayoutName(int layout);
+
+// MSB-first bit reader over an RBSP (emulation prevention bytes removed)
+// with exp-Golomb decoding. Reads past the end return zeros and set
+// overrun(), so callers check once at the end instead of on every read.
+class BitReader {
+public:
+    BitReader(const uint8_t *data, size_t size)
+        : m_data(data), m_sizeBits(size * 8) {}
+
+    uint32_t readBit() {
+        if (m_pos >= m_sizeBits) {
+            m_overrun = true;
+            return 0;
+        }
+        const uint32_t b = (m_data[m_pos >> 3] >> (7 - (m_pos & 7))) & 1u;
+        ++m_pos;
+        return b;
+    }
+
+    uint32_t readBits(int n) {
+        uint32_t v = 0;
+        for (int i = 0; i < n; ++i)
+            v = (v << 1) | readBit();
+        return v;
+    }
+
+    void skipBits(size_t n) {
+        m_pos += n;
+        if (m_pos > m_sizeBits) {
+            m_pos = m_sizeBits;
+            m_overrun = true;
+        }
+    }
+
+    // ue(v)
+    uint32_t readUE() {
+        int zeros = 0;
+        while (readBit() == 0) {
+            if (m_overrun || ++zeros > 31) {
+                m_overrun = true;
+                return 0;
+            }
+        }
+        if (zeros == 0)
+            return 0;
+        return ((1u << zeros) - 1u) + readBits(zeros);
+    }
+
+    // se(v)
+    int32_t readSE() {
+        const uint32_t k = readUE();
+        return (k & 1u) ? static_cast<int32_t>((k + 1) / 2)
+                        : -static_cast<int32_t>(k / 2);
+    }
+
+    bool overrun() const { return m_overrun; }
+
+private:
+    const uint8_t *m_data;
+    size_t         m_sizeBits;
+    size_t         m_pos{0};
+    bool           m_overrun{false};
+};
+
+// Copies a NAL payload into dst, dropping emulation prevention bytes
+// (00 00 03 -> 00 00). dst must hold size bytes. Returns the RBSP size.
+size_t h26xUnescapeRbsp(const uint8_t *src, size_t size, uint8_t *dst);
+
+struct SpsInfo {
+    bool valid{false};
+    int  id{0};
+    int  width{0};       // cropped picture size
+    int  height{0};
+    int  profile{0};
+    int  level{0};
+    int  chromaFormat{1};
+};
+
+// rbsp starts right after the NAL header (1 byte H.264, 2 bytes H.265)
+SpsInfo parseH264Sps(const uint8_t *rbsp, size_t size);
+SpsInfo parseHevcSps(const uint8_t *rbsp, size_t size);
+
+// Per-stream inspector. Not thread-safe (owned by one capture or recorder
+// thread); the counters can be read from any thread.
+class H26xBitstreamParser {
+public:
+    struct Result {
+        bool keyframe{false};          // IDR (H.264) / IRAP (H.265) slice present
+        bool hasParameterSets{false};  // SPS/PPS(/VPS) carried in-band
+        bool parameterSetsChanged{false}; // new content for a known (kind, id)
+        bool parameterSetAdded{false};    // first set of a new (kind, id)
+        bool sizeChanged{false};
+    };
+
+    explicit H26xBitstreamParser(AVCodecID codec = AV_CODEC_ID_NONE) { reset(codec); }
+
+    void reset(AVCodecID codec);
+    bool supported() const { return m_codec == AV_CODEC_ID_H264 || m_codec == AV_CODEC_ID_HEVC; }
+
+    // avcC / hvcC records or Annex B parameter sets. Sets the layout and the
+    // NAL length size used for AVCC packets. Returns false if not understood.
+    bool setExtradata(const uint8_t *data, size_t size);
+
+    // One access unit (demuxed packet). Stops at the first VCL NAL, so the
+    // cost does not depend on the slice data size.
+    Result inspect(const uint8_t *data, size_t size);
+
+    int width() const { return m_sps.valid ? m_sps.width : 0; }
+    int height() const { return m_sps.valid ? m_sps.height : 0; }
+    const SpsInfo &sps() const { return m_sps; }
+    int layout() const { return m_layout.load(std::memory_order_relaxed); }
+
+    // Latest VPS/SPS/PPS of each id seen (extradata or in-band) as Annex B,
+    // suitable as AVCodecParameters::extradata for the MP4 muxer.
+    std::vector<uint8_t> annexBParameterSets() const;
+
+    // Counters for /stats. inspectNs is sampled on 1 packet out of 16.
+    uint64_t packets() const { return m_packets.load(std::memory_order_relaxed); }
+    uint64_t keyframes() const { return m_keyframes.load(std::memory_order_relaxed); }
+    uint64_t parameterSetChanges() const { return m_psChanges.load(std::memory_order_relaxed); }
+    uint64_t avgInspectNs() const {
+        const uint64_t n = m_timedPackets.load(std::memory_order_relaxed);
+        return n ? m_timedNs.load(std::memory_order_relaxed) / n : 0;
+    }
+
+private:
+    bool isVcl(uint8_t header) const;
+    bool handleNal(const uint8_t *nal, size_t size, Result &r); // false = stop (VCL reached)
+    void storeParameterSet(int kind, const uint8_t *nal, size_t size, Result &r);
+    Result inspectAnnexB(const uint8_t *data, size_t size);
+    Result inspectLengthPrefixed(const uint8_t *data, size_t size);
+
+    AVCodecID m_codec{AV_CODEC_ID_NONE};
+    std::atomic<int> m_layout{NAL_LAYOUT_UNKNOWN};
+    int       m_nalLengthSize{4};
+    SpsInfo   m_sps;
+
+    // Raw parameter-set NALs (header included), one per (kind, id), sorted
+    // by kind (VPS/SPS/PPS) then id. Streams may carry several SPS/PPS: only
+    // a new content for an id already seen is a change.
+    enum { PS_VPS = 0, PS_SPS = 1, PS_PPS = 2 };
+    struct ParamSet {
+        int                  kind{0};
+        int                  id{0};
+        std::vector<uint8_t> nal;
+    };
+    std::vector<ParamSet> m_paramSets;
+    std::vector<uint8_t> m_rbsp; // reusable unescape buffer
+
+    std::atomic<uint64_t> m_packets{0};
+    std::atomic<uint64_t> m_keyframes{0};
+    std::atomic<uint64_t> m_psChanges{0};
+    std::atomic<uint64_t> m_timedPackets{0};
+    std::atomic<uint64_t> m_timedNs{0};
+};
+
+#endif /* __H26xBitstream_H__ */
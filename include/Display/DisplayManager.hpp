@@ -4,6 +4,7 @@
 
 #include "Utils.hpp"
 #include "Recording/MP4Recorder.hpp"
+#include "Display/FrameMailbox.hpp"
 
 class DisplayManager : public QObject {
     Q_OBJECT
@@ -33,11 +34,26 @@ public:
 
     void setVerboseLevel(int lvl){ mVerboseLevel = lvl; }
 
+    // Grid cell size. Capture threads are told to emit frames at this size
+    // (RtspCaptureThread::setFrameTargetSize) so no full-size copy or resize
+    // happens here.
+    static cv::Size cellSize() { return cv::Size(kCellWidth, kCellHeight); }
+
+    // Per-stream latest-frame slot, pulled on every refresh tick. Streams
+    // without a mailbox still deliver frames through onFrame().
+    void setFrameMailbox(const QString &streamId, std::shared_ptr<FrameMailbox> mailbox)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_mailboxes.insert(streamId, std::move(mailbox));
+    }
+
 
 public slots:
     void onFrame(const QString &streamId,const cv::Mat &frame) {
+        // Capture emits a freshly allocated, cell-sized Mat per frame: keep a
+        // reference instead of a deep copy
         QMutexLocker locker(&m_mutex);
-        m_lastFrames[streamId] = frame.clone();
+        m_lastFrames[streamId] = frame;
     }
 
 private slots:
@@ -45,6 +61,14 @@ private slots:
 
 
         QMutexLocker locker(&m_mutex);
+
+        // Pull the newest frame of each stream (no-op when nothing new)
+        for (auto it = m_mailboxes.begin(); it != m_mailboxes.end(); ++it) {
+            cv::Mat frame;
+            if (it.value()->take(frame))
+                m_lastFrames[it.key()] = frame;
+        }
+
         if (m_lastFrames.empty())
             return;
 
@@ -57,8 +81,8 @@ private slots:
             qDebug()<<" Bach of frames ready for display ==> Size : "<<n;
 
 
-        int cell_w = 320;
-        int cell_h = 240;
+        int cell_w = kCellWidth;
+        int cell_h = kCellHeight;
 
         cv::Mat grid(rows * cell_h, cols * cell_w, CV_8UC3, cv::Scalar(0,0,0));
         int idx = 0;
@@ -69,12 +93,13 @@ private slots:
 
             cv::Mat dstRoi = grid(roi);
             if (!it.value().empty()) {
-                cv::Mat resized;
-                cv::resize(it.value(), resized, cv::Size(cell_w, cell_h));
-                resized.copyTo(dstRoi);
+                if (it.value().cols == cell_w && it.value().rows == cell_h) {
+                    it.value().copyTo(dstRoi);
+                } else {
+                    cv::resize(it.value(), dstRoi, cv::Size(cell_w, cell_h));
+                }
 
-                // overlay streamId — draw onto the grid cell (dstRoi), not the
-                // temporary 'resized' (which was previously discarded).
+                // overlay streamId — draw onto the grid cell (dstRoi)
                 cv::putText(dstRoi,
                             it.key().toStdString(),
                             cv::Point(10, 20),
@@ -115,9 +140,13 @@ private:
     QHash<QString, Mp4RecorderWorker*> *m_recorders;
     QStringList  m_streamIds;
 
+    static constexpr int kCellWidth  = 320;
+    static constexpr int kCellHeight = 240;
+
     QTimer *m_timer = nullptr;
     QMutex  m_mutex;
     QHash<QString, cv::Mat> m_lastFrames;
+    QHash<QString, std::shared_ptr<FrameMailbox>> m_mailboxes;
     int mVerboseLevel = 0;
 };
 
@@ -0,0 +1,79 @@
+#ifndef __FrameMailbox_H__
+#define __FrameMailbox_H__
+
+#include "Utils.hpp"
+#include <atomic>
+
+// Latest-wins frame slot between one capture thread (producer) and the
+// display (consumer), replacing one queued frameReady event per frame.
+//
+// Triple buffer: the producer owns the back slot, the consumer the front
+// slot, and the middle slot is swapped atomically by both. A published
+// frame that was not taken yet is simply overwritten, so the display
+// always gets the newest frame and nothing piles up. Slots hold refcounted
+// cv::Mat (buffers come from the capture thread's FramePool).
+class FrameMailbox {
+public:
+    FrameMailbox() = default;
+
+    /// Producer side (capture thread)
+
+    // True when the last published frame has been taken. While it is not,
+    // producing another preview frame is wasted work.
+    bool consumed() const {
+        return (m_state.load(std::memory_order_acquire) & kFresh) == 0;
+    }
+
+    // Publishes a frame. The producer must not write into it afterwards.
+    void publish(const cv::Mat &frame) {
+        m_slots[m_back] = frame;
+        const uint8_t prev = m_state.exchange(static_cast<uint8_t>(m_back | kFresh),
+                                              std::memory_order_acq_rel);
+        m_back = prev & kIndexMask;
+        if (prev & kFresh)
+            m_overwritten.fetch_add(1, std::memory_order_relaxed);
+        m_published.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Frame dropped before conversion because the previous one was not taken
+    void noteSkipped() { m_skipped.fetch_add(1, std::memory_order_relaxed); }
+
+    /// Consumer side (display thread)
+
+    // Newest frame if one was published since the last call
+    bool take(cv::Mat &out) {
+        if ((m_state.load(std::memory_order_acquire) & kFresh) == 0)
+            return false;
+        const uint8_t prev = m_state.exchange(static_cast<uint8_t>(m_front),
+                                              std::memory_order_acq_rel);
+        m_front = prev & kIndexMask;
+        out = m_slots[m_front];
+        m_taken.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    sl::json statsJson() const {
+        sl::json j;
+        j["published"]   = m_published.load(std::memory_order_relaxed);
+        j["taken"]       = m_taken.load(std::memory_order_relaxed);
+        j["overwritten"] = m_overwritten.load(std::memory_order_relaxed);
+        j["skipped"]     = m_skipped.load(std::memory_order_relaxed);
+        return j;
+    }
+
+private:
+    static constexpr uint8_t kIndexMask = 0x3;
+    static constexpr uint8_t kFresh     = 0x4; // middle slot holds an untaken frame
+
+    cv::Mat m_slots[3];
+    std::atomic<uint8_t> m_state{1}; // middle index | kFresh
+    int m_back{0};                   // producer only
+    int m_front{2};                  // consumer only
+
+    std::atomic<uint64_t> m_published{0};
+    std::atomic<uint64_t> m_taken{0};
+    std::atomic<uint64_t> m_overwritten{0};
+    std::atomic<uint64_t> m_skipped{0};
+};
+
+#endif /* __FrameMailbox_H__ */
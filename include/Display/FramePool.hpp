@@ -0,0 +1,123 @@
+#ifndef __FramePool_H__
+#define __FramePool_H__
+
+#include "Utils.hpp"
+#include <atomic>
+#include <vector>
+
+// Per-stream pool of preview frame buffers (8UC3), owned by one capture
+// thread. A buffer is handed out again once every other reference to it
+// (mailbox slots, display) has been dropped, i.e. its cv::Mat refcount is
+// back to 1. Buffers come from cv::Mat's allocator (cv::fastMalloc, 64 byte
+// aligned rows for SIMD in sws_scale/copyTo).
+class FramePool {
+public:
+    explicit FramePool(size_t maxBuffers = kDefaultMaxBuffers)
+        : m_maxBuffers(maxBuffers) {}
+
+    // Writable buffer of the given size. Never blocks: when every pooled
+    // buffer is still in use a transient one is allocated (counted as miss).
+    cv::Mat acquire(int width, int height) {
+        if (width != m_width || height != m_height) {
+            // Resolution change: forget old buffers (freed when last user drops them)
+            m_buffers.clear();
+            m_width  = width;
+            m_height = height;
+        }
+        for (cv::Mat &m : m_buffers) {
+            if (m.u && m.u->refcount == 1) {
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return m;
+            }
+        }
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        cv::Mat m(height, width, CV_8UC3);
+        if (m_buffers.size() < m_maxBuffers) {
+            m_buffers.push_back(m);
+            m_pooled.store(m_buffers.size(), std::memory_order_relaxed);
+        }
+        return m;
+    }
+
+    sl::json statsJson() const {
+        sl::json j;
+        j["buffers"] = static_cast<uint64_t>(m_pooled.load(std::memory_order_relaxed));
+        j["hits"]    = m_hits.load(std::memory_order_relaxed);
+        j["misses"]  = m_misses.load(std::memory_order_relaxed);
+        return j;
+    }
+
+    // Mailbox (3 slots) + display reference + the one being converted
+    static constexpr size_t kDefaultMaxBuffers = 6;
+
+private:
+    size_t m_maxBuffers;
+    int    m_width{0};
+    int    m_height{0};
+    std::vector<cv::Mat> m_buffers;
+
+    std::atomic<size_t>   m_pooled{0};
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+};
+
+// Process-wide cache of the immutable status images (NO SIGNAL, ACQUIRING,
+// STREAM FAILED, ...) per text and resolution. Offline cameras republish the
+// same shared image instead of allocating and drawing one several times a
+// second. Consumers must not write into the returned frames.
+class StatusFrameCache {
+public:
+    static StatusFrameCache &instance() {
+        static StatusFrameCache cache;
+        return cache;
+    }
+
+    cv::Mat get(const QString &text, int width, int height) {
+        const QString key = QString("%1|%2x%3").arg(text).arg(width).arg(height);
+        QMutexLocker locker(&m_mutex);
+        auto it = m_frames.constFind(key);
+        if (it != m_frames.constEnd()) {
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return it.value();
+        }
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        cv::Mat img = render(text, width, height);
+        m_frames.insert(key, img);
+        return img;
+    }
+
+    sl::json statsJson() const {
+        sl::json j;
+        {
+            QMutexLocker locker(&m_mutex);
+            j["images"] = m_frames.size();
+        }
+        j["hits"]   = m_hits.load(std::memory_order_relaxed);
+        j["misses"] = m_misses.load(std::memory_order_relaxed);
+        return j;
+    }
+
+private:
+    StatusFrameCache() = default;
+
+    static cv::Mat render(const QString &text, int w, int h) {
+        cv::Mat img(h, w, CV_8UC3, cv::Scalar(40, 40, 40)); // dark gray
+        // Text sized relative to a 640 px wide frame so it fits small grid cells
+        const double scale = w / 640.0;
+        cv::putText(img,
+                    text.toStdString(),
+                    cv::Point(w/8, h/2),
+                    cv::FONT_HERSHEY_SIMPLEX,
+                    1.5 * scale,
+                    cv::Scalar(0, 0, 255),
+                    std::max(1, static_cast<int>(3 * scale + 0.5)));
+        return img;
+    }
+
+    mutable QMutex          m_mutex;
+    QHash<QString, cv::Mat> m_frames;
+    std::atomic<uint64_t>   m_hits{0};
+    std::atomic<uint64_t>   m_misses{0};
+};
+
+#endif /* __FramePool_H__ */
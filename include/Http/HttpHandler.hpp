@@ -8,6 +8,7 @@
 #include <QHash>
 #include <atomic>
 #include <thread>
+#include <functional>
 #include <QSet>
 
 // cpp-httlib (header-only)
@@ -27,6 +28,11 @@ public:
     void setVerboseLevel(int lvl){ mVerboseLevel = lvl; }
     void setFolderBase(QString p) {mFolderBasePath=p;}
 
+    // Builds the body of GET /stats. Called on the HTTP thread, so it must
+    // only read thread-safe counters. Set before start().
+    using StatsProvider = std::function<sl::json()>;
+    void setStatsProvider(StatsProvider p) { m_statsProvider = std::move(p); }
+
     // Optional: still allow setting a shared JSON payload for /data
     void setPayload(const QByteArray& payload, const QString& contentType = "application/json");
 
@@ -90,6 +96,8 @@ private:
     QHash<QString, bool>    m_streamingState;    // streamId -> is streaming
     QSet<QString>           m_knownStreams;      // all configured/known streams
 
+    StatsProvider m_statsProvider;
+
     int mVerboseLevel = 0;
     QString mFolderBasePath="~/";
 };
@@ -3,8 +3,18 @@
 #define __MP4Recorder_H__
 
 #include "Utils.hpp"
+#include "Recording/PacketQueue.hpp"
+#include "Recording/PrebufferRing.hpp"
+#include "Recording/PrebufferBudget.hpp"
+#include "Recording/RecordFileIO.hpp"
+#include "Recording/RecorderPool.hpp"
+#include "Codec/H26xBitstream.hpp"
 #include <QDebug>
+#include <atomic>
+#include <condition_variable>
 #include <ctime>
+#include <functional>
+#include <mutex>
 #include <QDir>
 
 class Mp4RecorderWorker : public QObject {
@@ -16,8 +26,53 @@ public:
         mFolder = "./";
     }
 
+    ~Mp4RecorderWorker() override {
+        // File tasks use this object: let them finish first
+        std::unique_lock<std::mutex> lock(m_fileMutex);
+        m_fileCond.wait(lock, [this]() { return m_fileTasks == 0; });
+        if (m_prepared.ctx) {
+            closeOutput(m_prepared.ctx, m_prepared.st);
+            QFile::remove(m_prepared.path);
+        }
+    }
+
     void setVerboseLevel(int lvl){ mVerboseLevel = lvl; }
 
+    // Long pre-roll: keep the prebuffer in a fixed-size mmap'ed file in
+    // 'folder' instead of memory. Falls back to memory on failure.
+    void setPrebufferDisk(const QString &folder, int sizeMb) {
+        QDir().mkpath(folder);
+        const QString path = QDir(folder).filePath(m_streamId + ".prebuf");
+        if (m_prebuffer.openFile(path, static_cast<size_t>(sizeMb) * 1024 * 1024))
+            qInfo() << "[REC]" << m_streamId << "disk prebuffer" << sizeMb << "MB in" << folder;
+        else
+            qWarning() << "[REC]" << m_streamId << "cannot create disk prebuffer in" << folder
+                       << "-> memory prebuffer";
+        updatePrebufferStats(false, 0.0);
+    }
+
+    // Shared pre-record memory budget (optional); set before the thread starts
+    void setPrebufferBudget(std::shared_ptr<PrebufferBudget> budget) {
+        m_budget = std::move(budget);
+        if (m_budget)
+            m_budget->registerStream(m_streamId);
+    }
+
+    // Packets arrive through this queue (filled by the capture thread) and
+    // are drained in batches on the recorder's thread.
+    void setPacketQueue(std::shared_ptr<PacketQueue> q) {
+        m_queue = std::move(q);
+        m_queue->setConsumerWakeup([this]() {
+            m_wakeupUs.storeRelaxed(RecorderThreadStats::nowUs());
+            QMetaObject::invokeMethod(this, "drainPackets", Qt::QueuedConnection);
+        });
+    }
+
+    // Counters of the writer thread this recorder runs on (RecorderPool)
+    void setDrainStats(RecorderThreadStats *stats) { m_drainStats = stats; }
+    // Slow file work goes to the pool's file threads (inline without a pool)
+    void setRecorderPool(RecorderPool *pool) { m_pool = pool; }
+
 
 
 signals:
@@ -31,6 +86,21 @@ public slots:
     void setFolderBase(QString path) { mFolder = path;}
     void setPreBufferingTime(float c) { pre_buffering_time = c;}
     void setPosteBufferingTime(float c) { post_buffering_time = c;}
+    // Roll to a new file every segmentSec seconds and/or segmentMb MB (0 = off),
+    // on a keyframe. Continuous: record as soon as the stream is known.
+    void setSegmentation(int segmentSec, int segmentMb, bool continuous) {
+        m_segmentSec = segmentSec;
+        m_segmentMb  = segmentMb;
+        m_continuous = continuous;
+    }
+    // Coalescing write buffer per file (0 = FFmpeg's avio_open)
+    void setWriteBufferSize(int kb) { m_writeBufferBytes = kb > 0 ? static_cast<size_t>(kb) * 1024 : 0; }
+    // RECORD_CACHE_*: keep written data in the page cache or not
+    void setRecordCachePolicy(int policy) { m_cachePolicy = policy; }
+    // Reserve each file's expected size on disk (needs the write buffer)
+    void setPreallocation(bool on) { m_preallocate = on; }
+    // Fragmented MP4: moof/mdat fragments of fragmentMs (and at keyframes)
+    void setFragmentedMp4(bool on, int fragmentMs) { m_fragmented = on; m_fragmentMs = fragmentMs; }
 
 
     void onStreamInfo(const StreamInfo &info)
@@ -41,51 +111,169 @@ public slots:
         m_height    = info.height;
         m_extradata = info.extradata;
         m_infoReady = true;
+
+        // Size still unknown upstream: take it from the SPS in the extradata
+        if (!m_extradata.isEmpty()) {
+            H26xBitstreamParser bs(static_cast<AVCodecID>(m_codecId));
+            if (bs.setExtradata(reinterpret_cast<const uint8_t*>(m_extradata.constData()),
+                                static_cast<size_t>(m_extradata.size()))) {
+                if ((m_width <= 0 || m_height <= 0) && bs.width() > 0) {
+                    m_width  = bs.width();
+                    m_height = bs.height();
+                }
+                if (mVerboseLevel > 0)
+                    qDebug() << "[REC]" << m_streamId << "extradata layout:"
+                             << nalLayoutName(bs.layout())
+                             << "w=" << m_width << "h=" << m_height;
+            }
+        }
         qInfo() << "[REC]" << m_streamId << "stream info ready";
+
+        // New parameters while recording (reconnect, SPS change): the open
+        // file keeps its extradata and timestamps would go back, so switch
+        // to a new file (timestamps restart there) on the next keyframe
+        if (m_recording) {
+            discardPreparedSegment();
+            m_streamChanged = true;
+            scheduleNextSegment();
+            qInfo() << "[REC]" << m_streamId << "stream changed, new file at next keyframe";
+        }
+
+        if (m_continuous && !m_recording)
+            startRecording();
+    }
+
+    void drainPackets() {
+        if (!m_queue)
+            return;
+        const qint64 wakeup = m_wakeupUs.loadRelaxed();
+        const qint64 start  = RecorderThreadStats::nowUs();
+        const size_t n = m_queue->drain([this](const EncodedVideoPacket &p) { onPacket(p); },
+                                        kDrainBatch);
+        if (m_drainStats)
+            m_drainStats->noteDrain(start - wakeup, RecorderThreadStats::nowUs() - start, n);
     }
 
     void onPacket(const EncodedVideoPacket &packet) {
-        // This slot runs in recorder's own thread (queued connection)
+        // Runs in recorder's own thread (drainPackets() or queued connection)
+        // Nothing to buffer or mux; a failed push() must only mean "full"
+        if (!PrebufferRing::storable(packet))
+            return;
+        double sec = 0.0;
+        const bool hasTs = packetSeconds(packet, sec);
+        trackGop(packet, hasTs, sec);
+
         // Prebuffer or write depending on recording state
         if (!m_recording) {
-            // Prebuffer for pre-roll
-            m_prebuffer.push_back(packet);
-            m_prebufferBytes += static_cast<size_t>(packet.data.size());
-
-            // Time-based trim: keep only the last pre_buffering_time seconds.
-            if (!m_prebuffer.empty()) {
-                const EncodedVideoPacket &last = m_prebuffer.back();
-                int64_t last_ts = (last.pts != AV_NOPTS_VALUE) ? last.pts : last.dts;
-                if (last_ts != AV_NOPTS_VALUE) {
-                    double last_sec = last_ts * av_q2d(last.time_base);
-                    while (!m_prebuffer.empty()) {
-                        const EncodedVideoPacket &first = m_prebuffer.front();
-                        int64_t first_ts = (first.pts != AV_NOPTS_VALUE) ? first.pts : first.dts;
-                        if (first_ts == AV_NOPTS_VALUE) break;
-                        double first_sec = first_ts * av_q2d(first.time_base);
-                        if (last_sec - first_sec > pre_buffering_time) {
-                            m_prebufferBytes -= static_cast<size_t>(m_prebuffer.front().data.size());
-                            m_prebuffer.pop_front();
-                        } else {
-                            break;
-                        }
-                    }
+            // Prebuffer for pre-roll. It always starts on a keyframe: packets
+            // before the first one could not be decoded in the file anyway.
+            if (packet.key) {
+                // Timestamps went back (reconnect): older GOPs can't be muxed
+                // in front of this one
+                if (hasTs && !m_gopStarts.empty() && m_gopStarts.back().hasTs &&
+                    sec < m_gopStarts.back().sec)
+                    clearPrebuffer();
+                resizePrebuffer();
+                m_gopStarts.push_back({m_prebufferSeq + m_prebuffer.size(), hasTs, sec});
+            } else if (m_prebuffer.empty()) {
+                ++m_leadingDropped;
+                return;
+            }
+
+            // Byte ring full at its maximum size (safety cap or share of the
+            // global budget): make room by whole GOPs
+            bool stored = m_prebuffer.push(packet);
+            if (!stored && budgetLimited())
+                noteBudgetTrim();
+            while (!stored && m_gopStarts.size() >= 2) {
+                dropOldestGop();
+                stored = m_prebuffer.push(packet);
+            }
+            if (!stored) {
+                // A single GOP over the cap: restart at the next IDR
+                clearPrebuffer();
+                if (packet.key) {
+                    m_gopStarts.push_back({m_prebufferSeq, hasTs, sec});
+                    if (!m_prebuffer.push(packet))
+                        m_gopStarts.clear();
                 }
             }
 
+            // GOP-aligned trim: drop the oldest GOP only while the next one
+            // still covers pre_buffering_time, so the pre-roll is never
+            // shorter than asked and the file starts on an IDR
+            if (hasTs) {
+                while (m_gopStarts.size() >= 2 && m_gopStarts[1].hasTs &&
+                       sec - m_gopStarts[1].sec >= pre_buffering_time)
+                    dropOldestGop();
+            }
+
             // Hard safety cap, independent of timestamps: a stream delivering
             // packets without usable PTS/DTS would otherwise grow the prebuffer
-            // without bound (OOM). Drop the oldest packets past the cap.
-            while (m_prebuffer.size() > kMaxPrebufferPackets ||
-                   m_prebufferBytes > kMaxPrebufferBytes) {
-                m_prebufferBytes -= static_cast<size_t>(m_prebuffer.front().data.size());
-                m_prebuffer.pop_front();
+            // without bound (OOM). Bytes are capped by the ring itself; drop
+            // the oldest GOPs past the packet cap.
+            while (m_prebuffer.size() > kMaxPrebufferPackets) {
+                if (m_gopStarts.size() >= 2)
+                    dropOldestGop();
+                else
+                    clearPrebuffer(); // a single GOP over the cap: restart at the next IDR
+            }
+            updatePrebufferStats(hasTs, sec);
+
+            // Continuous recording not running (open failed, /record/stop,
+            // stream info came before a file could be opened): start again
+            // on this keyframe, with the buffered pre-roll
+            if (packet.key && m_continuous && m_infoReady && restartDue())
+                startRecording();
+        } else if (m_flushing) {
+            // Pre-roll still being written: queue behind it to keep the order
+            if (!m_prebuffer.push(packet)) {
+                flushPrebuffer(SIZE_MAX);
+                writePacket(packet);
             }
         } else {
+            // Segment rotation happens on the keyframe that starts the new
+            // file. After a stream change the current file cannot take the
+            // new packets: they wait for that keyframe.
+            if (packet.key && (m_streamChanged || segmentDue()))
+                rotateSegment();
+            if (m_streamChanged) {
+                ++m_leadingDropped;
+                m_leadingDroppedStat.storeRelease(m_leadingDropped);
+                return;
+            }
             writePacket(packet);
+            if (!m_nextPending && segmentDue(kSegmentPrepareLeadMs))
+                scheduleNextSegment();
         }
     }
 
+    // Prebuffer and GOP counters for /stats (atomics, any thread)
+    sl::json statsJson() const
+    {
+        sl::json j;
+        j["gop_ms_avg"]        = m_gopMsAvg.loadAcquire();
+        j["gop_packets_avg"]   = m_gopPacketsAvg.loadAcquire();
+        j["prebuffer_ms"]      = m_prebufferMs.loadAcquire();
+        j["prebuffer_packets"] = m_prebufferPackets.loadAcquire();
+        j["prebuffer_gops"]    = m_prebufferGops.loadAcquire();
+        j["prebuffer_bytes"]   = m_prebufferBytesStat.loadAcquire();
+        j["ring_capacity"]     = m_ringCapacity.loadAcquire();
+        j["ring_reallocs"]     = m_ringReallocs.loadAcquire();
+        j["ring_max_bytes"]    = m_ringMaxBytes.loadAcquire();
+        j["budget_trims"]      = m_budgetTrimsStat.loadAcquire();
+        j["storage"]           = m_prebufferOnDisk.loadAcquire() ? "disk" : "memory";
+        j["mp4_mode"]          = m_fragmented ? "fragmented" : "classic";
+        j["last_finalize_ms"]  = m_lastFinalizeMs.loadAcquire(); // trailer + close
+        j["io"]                = m_ioStats.statsJson();
+        j["prealloc_estimate_bytes"] = m_lastPreallocBytes.loadAcquire(); // last file
+        j["segments"]          = m_segments.loadAcquire();
+        j["last_segment_open_ms"] = m_lastSegmentOpenMs.loadAcquire();
+        j["sync_segment_opens"]   = m_syncSegmentOpens.loadAcquire();
+        j["leading_dropped"]   = m_leadingDroppedStat.loadAcquire();
+        return j;
+    }
+
     void startRecording() {
         if (m_recording) {
             qInfo() << "[REC]" << m_streamId << "already recording";
@@ -98,76 +286,36 @@ public slots:
         }
 
         QString filename = makeRecordFilename(m_streamId,mFolder);
-
-        if (avformat_alloc_output_context2(&m_outCtx, nullptr, "mp4",
-                                           filename.toUtf8().constData()) < 0 || !m_outCtx) {
-            if(mVerboseLevel>0)
-                qWarning() << "[REC]" << m_streamId << "failed to alloc output context";
-            m_outCtx = nullptr;
-            emit recordingFailed(m_streamId, "failed to alloc output context");
-            return;
-        }
-
-        m_outStream = avformat_new_stream(m_outCtx, nullptr);
-        if (!m_outStream) {
-            if(mVerboseLevel>0)
-                qWarning() << "[REC]" << m_streamId << "failed to alloc new stream";
-            avformat_free_context(m_outCtx);
-            m_outCtx = nullptr;
-            emit recordingFailed(m_streamId, "failed to alloc new stream");
-            return;
-        }
-
-        AVCodecParameters *cp = m_outStream->codecpar;
-        memset(cp, 0, sizeof(*cp));
-        cp->codec_type = AVMEDIA_TYPE_VIDEO;
-        cp->codec_id   = (AVCodecID)m_codecId;
-        cp->codec_tag  = 0;              // let muxer choose
-        cp->width      = m_width;
-        cp->height     = m_height;
-        if (!m_extradata.isEmpty()) {
-            cp->extradata_size = m_extradata.size();
-            cp->extradata = (uint8_t*)av_malloc(cp->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
-            memcpy(cp->extradata, m_extradata.constData(), cp->extradata_size);
-            memset(cp->extradata + cp->extradata_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
-        }
-        m_outStream->time_base = m_timeBase;
-
-        if (!(m_outCtx->oformat->flags & AVFMT_NOFILE)) {
-            if (avio_open(&m_outCtx->pb, filename.toUtf8().constData(), AVIO_FLAG_WRITE) < 0) {
-                if(mVerboseLevel>0)
-                    qWarning() << "[REC]" << m_streamId << "failed to create REC file";
-                avformat_free_context(m_outCtx);
-                m_outCtx = nullptr;
-                m_outStream = nullptr;
-                emit recordingFailed(m_streamId, "failed to create output file");
-                return;
-            }
-        }
-
-        if (avformat_write_header(m_outCtx, nullptr) < 0) {
-            if (!(m_outCtx->oformat->flags & AVFMT_NOFILE)) {
-                if(mVerboseLevel>0)
-                    qWarning() << "[REC]" << m_streamId << "failed to write header to REC file";
-                avio_closep(&m_outCtx->pb);
-            }
-            avformat_free_context(m_outCtx);
-            m_outCtx = nullptr;
-            m_outStream = nullptr;
-            emit recordingFailed(m_streamId, "failed to write MP4 header");
+        QString error;
+        if (!openOutput(filename, outputParams(), m_outCtx, m_outStream, error)) {
+            // Continuous: onPacket() tries again on a later keyframe
+            m_restartDelayMs = m_restartDelayMs > 0 ? std::min(m_restartDelayMs * 2, kRestartMaxMs)
+                                                    : kRestartMinMs;
+            m_restartTimer.start();
+            if (m_continuous)
+                qWarning() << "[REC]" << m_streamId << "cannot start recording:" << error
+                           << "- retrying in" << m_restartDelayMs << "ms";
+            emit recordingFailed(m_streamId, error);
             return;
         }
+        m_restartDelayMs = 0;
 
         m_recStartPts = AV_NOPTS_VALUE;
+        m_fileHasKey  = false;
+        m_streamChanged = false;
         m_recording = true;
-
-        // Flush prebuffer
-        for (const auto &p : m_prebuffer) {
-            writePacket(p);
-        }
-        m_prebuffer.clear();
-        m_prebufferBytes = 0;
-
+        m_segmentTimer.start();
+        m_segmentBytes = 0;
+
+        // Flush prebuffer (starts on a keyframe). A long (disk) pre-roll is
+        // written in chunks from the event loop so live packets keep being
+        // drained meanwhile; they queue behind it in the ring.
+        m_gopStarts.clear();
+        m_flushing = !m_prebuffer.empty();
+        if (m_flushing)
+            QMetaObject::invokeMethod(this, "flushPrebufferChunk", Qt::QueuedConnection);
+
+        m_currentPath = filename;
         emit recordingStarted(m_streamId, filename);
         qInfo() << "[REC]" << m_streamId << "started recording ->" << filename;
     }
@@ -211,6 +359,14 @@ public slots:
 
 
 private slots:
+    void flushPrebufferChunk() {
+        if (!m_recording || !m_flushing)
+            return;
+        flushPrebuffer(kFlushChunkBytes);
+        if (m_flushing)
+            QMetaObject::invokeMethod(this, "flushPrebufferChunk", Qt::QueuedConnection);
+    }
+
     void onPostBufferTimeout() {
         // Called after post_buffering_time seconds in the recorder thread's event loop
         if (m_recording && m_stopPending) {
@@ -230,22 +386,110 @@ private:
 
     float pre_buffering_time = 5.0;
     float post_buffering_time = 1.0;
+    bool  m_fragmented = false;
+    int   m_fragmentMs = 1000;
+    QAtomicInteger<int> m_lastFinalizeMs{-1};
+    size_t        m_writeBufferBytes = 0;
+    int           m_cachePolicy = RECORD_CACHE_NORMAL;
+    bool          m_preallocate = false;
+    double        m_recordSecEma = 0.0; // wall time of this stream's event recordings
+    QAtomicInteger<qint64> m_lastPreallocBytes{0};
+    RecordIoStats m_ioStats;
+    static constexpr double  kPreallocDefaultSec    = 60.0;  // no recording measured yet
+    static constexpr double  kPreallocContinuousSec = 600.0; // continuous without segments
+    static constexpr int64_t kPreallocMinStep       = 8 * 1024 * 1024;
+    static constexpr int64_t kPreallocMaxBytes      = 4LL * 1024 * 1024 * 1024;
+
+    // Segment rotation (continuous recording)
+    int     m_segmentSec = 0;
+    int     m_segmentMb  = 0;
+    bool    m_continuous = false;
+    QElapsedTimer m_segmentTimer;
+    qint64  m_segmentBytes = 0;
+    QString m_currentPath;
+    QString m_lastNextPath;         // last path handed to a file task
+    bool    m_nextPending   = false; // next segment being opened ahead, or ready
+    bool    m_streamChanged = false; // new StreamInfo: new file at next keyframe
+    QElapsedTimer m_restartTimer;    // continuous: since the last failed start
+    int     m_restartDelayMs = 0;    // 0 = last start succeeded
+    static constexpr int kRestartMinMs = 1000;
+    static constexpr int kRestartMaxMs = 60000;
+    static constexpr int kSegmentPrepareLeadMs = 2000;
+    QAtomicInteger<int> m_segments{0};
+    QAtomicInteger<int> m_lastSegmentOpenMs{-1};
+    QAtomicInteger<int> m_syncSegmentOpens{0};
 
     bool           m_recording   = false;
     AVFormatContext *m_outCtx    = nullptr;
     AVStream        *m_outStream = nullptr;
     int64_t         m_recStartPts = AV_NOPTS_VALUE;
 
-    std::deque<EncodedVideoPacket> m_prebuffer;
-    size_t          m_prebufferBytes = 0;
-
     // Hard safety caps that bound prebuffer memory even for streams whose
     // packets carry no usable PTS/DTS (see onPacket()).
     static constexpr size_t kMaxPrebufferPackets = 100000;
     static constexpr size_t kMaxPrebufferBytes   = 512ull * 1024 * 1024; // 512 MB
 
+    PrebufferRing   m_prebuffer{kMaxPrebufferBytes};
+    std::shared_ptr<PrebufferBudget> m_budget;
+    bool            m_flushing = false; // recording, pre-roll not fully written yet
+    static constexpr size_t kFlushChunkBytes = 8 * 1024 * 1024;
+    quint64         m_budgetTrims = 0;
+
+    // Keyframes in the prebuffer, by absolute packet sequence number
+    // (m_prebufferSeq = sequence number of m_prebuffer.front())
+    struct GopStart {
+        size_t seq;
+        bool   hasTs;
+        double sec;
+    };
+    std::deque<GopStart> m_gopStarts;
+    size_t          m_prebufferSeq   = 0;
+    quint64         m_leadingDropped = 0; // non-key packets before the first keyframe
+    bool            m_fileHasKey     = false;
+
+    // GOP length measurement (all packets, recording or not)
+    bool            m_lastKeyHasTs   = false;
+    double          m_lastKeySec     = 0.0;
+    int             m_packetsSinceKey = 0;
+    size_t          m_bytesSinceKey  = 0;
+    double          m_gopSecEma      = 0.0;
+    double          m_gopPacketsEma  = 0.0;
+    double          m_gopBytesEma    = 0.0;
+
+    QAtomicInteger<int>     m_gopMsAvg{0};
+    QAtomicInteger<int>     m_gopPacketsAvg{0};
+    QAtomicInteger<int>     m_prebufferMs{0};
+    QAtomicInteger<int>     m_prebufferPackets{0};
+    QAtomicInteger<int>     m_prebufferGops{0};
+    QAtomicInteger<qint64>  m_prebufferBytesStat{0};
+    QAtomicInteger<qint64>  m_ringCapacity{0};
+    QAtomicInteger<qint64>  m_ringMaxBytes{0};
+    QAtomicInteger<int>     m_prebufferOnDisk{0};
+    QAtomicInteger<quint64> m_ringReallocs{0};
+    QAtomicInteger<quint64> m_budgetTrimsStat{0};
+    QAtomicInteger<quint64> m_leadingDroppedStat{0};
+
     AVPacket       *m_pkt = nullptr; // reusable output packet (avoids stack AVPacket / av_init_packet)
 
+    std::shared_ptr<PacketQueue> m_queue;
+    RecorderThreadStats   *m_drainStats = nullptr;
+    RecorderPool          *m_pool       = nullptr;
+
+    // Segment opened ahead on a file thread. m_outputGen is bumped when a
+    // segment being opened becomes stale; its task then drops it.
+    struct PreparedOutput {
+        AVFormatContext *ctx = nullptr;
+        AVStream        *st  = nullptr;
+        QString          path;
+    };
+    std::mutex              m_fileMutex;
+    std::condition_variable m_fileCond;
+    int                     m_fileTasks = 0; // in flight, m_fileMutex
+    PreparedOutput          m_prepared;      // m_fileMutex
+    std::atomic<int>        m_outputGen{0};
+    QAtomicInteger<qint64> m_wakeupUs{0}; // last queue wakeup posted
+    static constexpr size_t kDrainBatch = 256;
+
     QString mFolder = "./";
 
 
@@ -271,57 +515,563 @@ private:
         return QString("%1/rec_%2_%3.mp4").arg(folder,streamId, buf);
     }
 
+    // What openOutput() needs, copied on the recorder thread so that a file
+    // thread can open the file while the recorder goes on
+    struct OutputParams {
+        int        codecId = 0;
+        AVRational timeBase{1, 1};
+        int        width   = 0;
+        int        height  = 0;
+        QByteArray extradata;
+        bool       fragmented = false;
+        int        fragmentMs = 0;
+        size_t     writeBufferBytes = 0;
+        int        cachePolicy  = RECORD_CACHE_NORMAL;
+        bool       preallocate  = false;
+        int64_t    preallocBytes = 0;
+    };
+
+    OutputParams outputParams() const {
+        OutputParams p;
+        p.codecId          = m_codecId;
+        p.timeBase         = m_timeBase;
+        p.width            = m_width;
+        p.height           = m_height;
+        p.extradata        = m_extradata;
+        p.fragmented       = m_fragmented;
+        p.fragmentMs       = m_fragmentMs;
+        p.writeBufferBytes = m_writeBufferBytes;
+        p.cachePolicy      = m_cachePolicy;
+        p.preallocate      = m_preallocate;
+        p.preallocBytes    = m_preallocate ? expectedFileBytes() : 0;
+        return p;
+    }
+
+    // Create the MP4 file, its video stream and write the header. Only uses
+    // 'p' and thread-safe members: may run on a file thread.
+    bool openOutput(const QString &filename, const OutputParams &p,
+                    AVFormatContext *&ctx, AVStream *&st, QString &error) {
+        if (avformat_alloc_output_context2(&ctx, nullptr, "mp4",
+                                           filename.toUtf8().constData()) < 0 || !ctx) {
+            if(mVerboseLevel>0)
+                qWarning() << "[REC]" << m_streamId << "failed to alloc output context";
+            ctx = nullptr;
+            error = "failed to alloc output context";
+            return false;
+        }
+
+        st = avformat_new_stream(ctx, nullptr);
+        if (!st) {
+            if(mVerboseLevel>0)
+                qWarning() << "[REC]" << m_streamId << "failed to alloc new stream";
+            avformat_free_context(ctx);
+            ctx = nullptr;
+            error = "failed to alloc new stream";
+            return false;
+        }
+
+        AVCodecParameters *cp = st->codecpar;
+        memset(cp, 0, sizeof(*cp));
+        cp->codec_type = AVMEDIA_TYPE_VIDEO;
+        cp->codec_id   = (AVCodecID)p.codecId;
+        cp->codec_tag  = 0;              // let muxer choose
+        cp->width      = p.width;
+        cp->height     = p.height;
+        if (!p.extradata.isEmpty()) {
+            cp->extradata_size = p.extradata.size();
+            cp->extradata = (uint8_t*)av_malloc(cp->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+            memcpy(cp->extradata, p.extradata.constData(), cp->extradata_size);
+            memset(cp->extradata + cp->extradata_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        }
+        st->time_base = p.timeBase;
+
+        if (!(ctx->oformat->flags & AVFMT_NOFILE)) {
+            bool opened = false;
+            if (p.writeBufferBytes > 0 || p.cachePolicy != RECORD_CACHE_NORMAL) {
+                // Own AVIOContext with a large coalescing buffer
+                RecordFileIO *io = new RecordFileIO(p.writeBufferBytes, &m_ioStats, p.cachePolicy);
+                if (io->open(filename)) {
+                    if (p.preallocate) {
+                        const int64_t bytes = p.preallocBytes;
+                        m_lastPreallocBytes.storeRelease(bytes);
+                        io->preallocate(bytes, std::max(bytes / 4, kPreallocMinStep));
+                    }
+                    ctx->pb     = io->avio();
+                    ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+                    opened = true;
+                } else {
+                    delete io;
+                }
+            } else {
+                opened = avio_open(&ctx->pb, filename.toUtf8().constData(), AVIO_FLAG_WRITE) >= 0;
+            }
+            if (!opened) {
+                if(mVerboseLevel>0)
+                    qWarning() << "[REC]" << m_streamId << "failed to create REC file";
+                freeOutput(ctx, st);
+                error = "failed to create output file";
+                return false;
+            }
+        }
+
+        // Fragmented: the moov is written up front (empty) and every fragment
+        // carries its own index, so the file is playable while being written,
+        // survives a crash, and the trailer is constant size. Without
+        // out-of-band extradata the moov waits for the first fragment.
+        AVDictionary *muxOpts = nullptr;
+        if (p.fragmented) {
+            av_dict_set(&muxOpts, "movflags",
+                        p.extradata.isEmpty() ? "frag_keyframe+delay_moov+default_base_moof"
+                                              : "frag_keyframe+empty_moov+default_base_moof", 0);
+            if (p.fragmentMs > 0)
+                av_dict_set_int(&muxOpts, "frag_duration", static_cast<int64_t>(p.fragmentMs) * 1000, 0);
+        }
+        const int hret = avformat_write_header(ctx, &muxOpts);
+        av_dict_free(&muxOpts);
+        if (hret < 0) {
+            if (!(ctx->oformat->flags & AVFMT_NOFILE)) {
+                if(mVerboseLevel>0)
+                    qWarning() << "[REC]" << m_streamId << "failed to write header to REC file";
+                closeFile(ctx);
+            }
+            freeOutput(ctx, st);
+            error = "failed to write MP4 header";
+            return false;
+        }
+        return true;
+    }
+
+    // Trailer + close. Returns the time it took (ms).
+    int closeOutput(AVFormatContext *&ctx, AVStream *&st) {
+        if (!ctx)
+            return 0;
+        QElapsedTimer timer;
+        timer.start();
+        av_write_trailer(ctx);
+        if (!(ctx->oformat->flags & AVFMT_NOFILE)) {
+            closeFile(ctx);
+        }
+        freeOutput(ctx, st);
+        return static_cast<int>(timer.elapsed());
+    }
+
+    // Expected size of a new file from the measured bitrate: a segment, or
+    // the usual length of this stream's recordings plus pre/post-roll.
+    // 0 until the bitrate is known (no preallocation).
+    int64_t expectedFileBytes() const {
+        if (m_gopSecEma <= 0.0 || m_gopBytesEma <= 0.0)
+            return 0;
+        const double bytesPerSec = m_gopBytesEma / m_gopSecEma;
+        double sec;
+        if (m_segmentSec > 0)
+            sec = m_segmentSec;
+        else if (m_continuous)
+            sec = kPreallocContinuousSec;
+        else
+            sec = pre_buffering_time + post_buffering_time +
+                  (m_recordSecEma > 0.0 ? m_recordSecEma : kPreallocDefaultSec);
+        int64_t bytes = static_cast<int64_t>(bytesPerSec * sec * 1.1);
+        if (m_segmentMb > 0) {
+            const int64_t limit = static_cast<int64_t>(m_segmentMb) * 1024 * 1024;
+            bytes = (m_segmentSec > 0) ? std::min(bytes, limit) : limit;
+        }
+        return std::min(bytes, kPreallocMaxBytes);
+    }
+
+    void closeFile(AVFormatContext *ctx) {
+        if (ctx->flags & AVFMT_FLAG_CUSTOM_IO) {
+            RecordFileIO *io = ctx->pb ? RecordFileIO::fromAvio(ctx->pb) : nullptr;
+            ctx->pb = nullptr;
+            if (io && !io->close())
+                qWarning() << "[REC]" << m_streamId << "write error on REC file";
+            delete io;
+        } else {
+            avio_closep(&ctx->pb);
+        }
+    }
+
+    void freeOutput(AVFormatContext *&ctx, AVStream *&st) {
+        if (st && st->codecpar && st->codecpar->extradata) {
+            av_freep(&st->codecpar->extradata);
+        }
+        avformat_free_context(ctx);
+        ctx = nullptr;
+        st  = nullptr;
+    }
 
+    static bool packetSeconds(const EncodedVideoPacket &p, double &sec) {
+        const int64_t ts = (p.pts != AV_NOPTS_VALUE) ? p.pts : p.dts;
+        if (ts == AV_NOPTS_VALUE)
+            return false;
+        sec = ts * av_q2d(p.time_base);
+        return true;
+    }
+
+    void trackGop(const EncodedVideoPacket &packet, bool hasTs, double sec) {
+        if (!packet.key) {
+            ++m_packetsSinceKey;
+            m_bytesSinceKey += static_cast<size_t>(packet.size());
+            return;
+        }
+        if (hasTs && m_lastKeyHasTs) {
+            const double gop = sec - m_lastKeySec;
+            if (gop > 0.0 && gop < 60.0) {
+                m_gopSecEma     = (m_gopSecEma > 0.0) ? 0.8 * m_gopSecEma + 0.2 * gop : gop;
+                m_gopPacketsEma = (m_gopPacketsEma > 0.0)
+                                  ? 0.8 * m_gopPacketsEma + 0.2 * (m_packetsSinceKey + 1)
+                                  : m_packetsSinceKey + 1;
+                m_gopBytesEma   = (m_gopBytesEma > 0.0)
+                                  ? 0.8 * m_gopBytesEma + 0.2 * m_bytesSinceKey
+                                  : m_bytesSinceKey;
+                m_gopMsAvg.storeRelease(static_cast<int>(m_gopSecEma * 1000.0));
+                m_gopPacketsAvg.storeRelease(static_cast<int>(m_gopPacketsEma + 0.5));
+            }
+        }
+        m_lastKeyHasTs    = hasTs;
+        m_lastKeySec      = sec;
+        m_packetsSinceKey = 0;
+        m_bytesSinceKey   = static_cast<size_t>(packet.size());
+    }
+
+    // Size the byte ring from the measured bitrate: pre-roll plus up to two
+    // GOPs (trim granularity), with some headroom. Only moves on large
+    // changes, a resize copies what is buffered. The global budget (if any)
+    // caps the ring at this stream's share. A disk ring has a fixed size and
+    // does not count against the (memory) budget.
+    void resizePrebuffer() {
+        if (m_prebuffer.isFileBacked())
+            return;
+        const bool measured = m_gopSecEma > 0.0 && m_gopBytesEma > 0.0;
+        const double bytesPerSec = measured ? m_gopBytesEma / m_gopSecEma : 0.0;
+
+        size_t maxBytes = kMaxPrebufferBytes;
+        if (m_budget) {
+            // Need: the pre-roll plus the GOP it may start in
+            const qint64 needed = static_cast<qint64>(
+                        bytesPerSec * (pre_buffering_time + m_gopSecEma));
+            const qint64 allowed = m_budget->report(m_streamId, needed,
+                                                    static_cast<qint64>(m_prebuffer.capacity()));
+            if (allowed >= 0)
+                maxBytes = std::min(maxBytes, static_cast<size_t>(allowed));
+        }
+        m_prebuffer.setMaxCapacity(maxBytes);
+
+        // Share lowered below what is buffered: trim now
+        if (m_prebuffer.bytes() > maxBytes && m_gopStarts.size() >= 2) {
+            if (budgetLimited())
+                noteBudgetTrim();
+            while (m_prebuffer.bytes() > maxBytes && m_gopStarts.size() >= 2)
+                dropOldestGop();
+        }
+
+        if (!measured) {
+            if (m_prebuffer.capacity() > maxBytes)
+                m_prebuffer.reserve(maxBytes);
+            return;
+        }
+        const size_t target = std::min(maxBytes, static_cast<size_t>(
+                    bytesPerSec * (pre_buffering_time + 2.0 * m_gopSecEma) * 1.25));
+        if (target > m_prebuffer.capacity() || m_prebuffer.capacity() > 3 * target ||
+            m_prebuffer.capacity() > maxBytes)
+            m_prebuffer.reserve(target);
+    }
+
+    // The ring's limit is this stream's share of the global budget (not the
+    // safety cap, nor a fixed-size disk ring)
+    bool budgetLimited() const {
+        return m_budget && !m_prebuffer.isFileBacked() &&
+               m_prebuffer.maxCapacity() < kMaxPrebufferBytes;
+    }
+
+    // Pre-roll dropped to stay within the budget share (not the normal
+    // time-based trim). Callers check budgetLimited().
+    void noteBudgetTrim() {
+        ++m_budgetTrims;
+        m_budgetTrimsStat.storeRelease(m_budgetTrims);
+        m_budget->noteTrim(m_streamId);
+    }
+
+    void dropOldestGop() {
+        const size_t next = m_gopStarts[1].seq;
+        while (m_prebufferSeq < next && !m_prebuffer.empty()) {
+            m_prebuffer.popFront();
+            ++m_prebufferSeq;
+        }
+        m_gopStarts.pop_front();
+    }
+
+    void clearPrebuffer() {
+        m_prebufferSeq += m_prebuffer.size();
+        m_prebuffer.clear();
+        m_gopStarts.clear();
+    }
+
+    void updatePrebufferStats(bool hasTs, double lastSec) {
+        int ms = 0;
+        if (hasTs && !m_gopStarts.empty() && m_gopStarts.front().hasTs)
+            ms = static_cast<int>((lastSec - m_gopStarts.front().sec) * 1000.0);
+        m_prebufferMs.storeRelease(ms);
+        m_prebufferPackets.storeRelease(static_cast<int>(m_prebuffer.size()));
+        m_prebufferGops.storeRelease(static_cast<int>(m_gopStarts.size()));
+        m_prebufferBytesStat.storeRelease(static_cast<qint64>(m_prebuffer.bytes()));
+        m_ringCapacity.storeRelease(static_cast<qint64>(m_prebuffer.capacity()));
+        m_ringMaxBytes.storeRelease(static_cast<qint64>(m_prebuffer.maxCapacity()));
+        m_prebufferOnDisk.storeRelease(m_prebuffer.isFileBacked() ? 1 : 0);
+        m_ringReallocs.storeRelease(m_prebuffer.reallocs());
+        m_leadingDroppedStat.storeRelease(m_leadingDropped);
+    }
+
+
+    // Live packet: the muxer takes a new reference on the shared payload
     void writePacket(const EncodedVideoPacket &packet) {
-        if (!m_recording || !m_outCtx || !m_outStream) return;
+        if (!packet.packet || !beginPacket(packet.key)) return;
+
+        // No copy: the demuxer's buffer is refcounted.
+        // av_interleaved_write_frame() consumes the reference.
+        if (av_packet_ref(m_pkt, packet.packet.get()) < 0) {
+            if(mVerboseLevel>0)
+                qWarning() << "[REC]" << m_streamId << "av_packet_ref failed";
+            return;
+        }
+        muxPacket(packet.pts, packet.dts, packet.duration, packet.key, packet.time_base);
+    }
+
+    // Pre-roll packet: payload copied out of the prebuffer ring
+    void writeBuffered(const PrebufferRing::Entry &e) {
+        if (!beginPacket(e.key)) return;
+
+        if (av_new_packet(m_pkt, e.size) < 0) {
+            if(mVerboseLevel>0)
+                qWarning() << "[REC]" << m_streamId << "av_new_packet failed";
+            return;
+        }
+        memcpy(m_pkt->data, m_prebuffer.data(e), static_cast<size_t>(e.size));
+        muxPacket(e.pts, e.dts, e.duration, e.key, e.time_base);
+    }
+
+    // Continuous mode may start a file again (backoff after a failed open)
+    bool restartDue() const {
+        return m_restartDelayMs == 0 || m_restartTimer.elapsed() >= m_restartDelayMs;
+    }
+
+    bool segmentDue(int leadMs = 0) const {
+        if (m_segmentSec > 0 &&
+            m_segmentTimer.elapsed() + leadMs >= static_cast<qint64>(m_segmentSec) * 1000)
+            return true;
+        if (m_segmentMb > 0) {
+            const qint64 limit = static_cast<qint64>(m_segmentMb) * 1024 * 1024;
+            return m_segmentBytes >= (leadMs > 0 ? limit - limit / 20 : limit); // prepare at 95%
+        }
+        return false;
+    }
+
+    // Run off the writer thread, on one of the pool's file threads
+    void runFileTask(std::function<void()> task) {
+        if (!m_pool) {
+            task();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_fileMutex);
+            ++m_fileTasks;
+        }
+        m_pool->runFileTask([this, task]() {
+            task();
+            std::lock_guard<std::mutex> lock(m_fileMutex);
+            if (--m_fileTasks == 0)
+                m_fileCond.notify_all();
+        });
+    }
+
+    QString nextSegmentPath() {
+        const QString base = makeRecordFilename(m_streamId, mFolder);
+        QString path = base;
+        // Several segments in the same second (small segment_mb), or a stale
+        // open of the same name still in flight
+        for (int n = 1; QFile::exists(path) || path == m_lastNextPath || path == m_currentPath; ++n)
+            path = base.left(base.size() - 4) + QString("_%1.mp4").arg(n);
+        m_lastNextPath = path;
+        return path;
+    }
+
+    // Open the next segment's file on a file thread, shortly before the
+    // rotation is due (or right after a stream change)
+    void scheduleNextSegment() {
+        m_nextPending = true;
+        const OutputParams params = outputParams();
+        const QString      path   = nextSegmentPath();
+        const int          gen    = m_outputGen.load();
+        runFileTask([this, params, path, gen]() {
+            QElapsedTimer timer;
+            timer.start();
+            PreparedOutput next;
+            next.path = path;
+            QString error;
+            if (!openOutput(path, params, next.ctx, next.st, error)) {
+                qWarning() << "[REC]" << m_streamId << "cannot prepare next segment:" << error;
+                return; // opened on the packet path at rotation
+            }
+            m_lastSegmentOpenMs.storeRelease(static_cast<int>(timer.elapsed()));
+            {
+                std::lock_guard<std::mutex> lock(m_fileMutex);
+                if (gen == m_outputGen.load() && !m_prepared.ctx) {
+                    m_prepared = next;
+                    return;
+                }
+            }
+            // Stale (stream changed, recording stopped): never used
+            closeOutput(next.ctx, next.st);
+            QFile::remove(path);
+        });
+    }
+
+    // Drop the segment opened (or being opened) ahead
+    void discardPreparedSegment() {
+        m_outputGen.fetch_add(1);
+        m_nextPending = false;
+        PreparedOutput stale;
+        {
+            std::lock_guard<std::mutex> lock(m_fileMutex);
+            std::swap(stale, m_prepared);
+        }
+        if (!stale.ctx)
+            return;
+        runFileTask([this, stale]() mutable {
+            closeOutput(stale.ctx, stale.st);
+            QFile::remove(stale.path);
+        });
+    }
+
+    // Trailer of a segment rotated out (a classic MP4 writes its whole
+    // index there), on a file thread
+    void closeRotatedSegment(AVFormatContext *ctx, AVStream *st, const QString &path) {
+        runFileTask([this, ctx, st, path]() mutable {
+            m_lastFinalizeMs.storeRelease(closeOutput(ctx, st));
+            if (mVerboseLevel > 0)
+                qDebug() << "[REC]" << m_streamId << "segment closed" << path;
+        });
+    }
+
+    // Switch to the prepared file on this keyframe: no packet is lost or
+    // written twice, the old file gets its trailer on a file thread
+    bool rotateSegment() {
+        PreparedOutput next;
+        {
+            std::lock_guard<std::mutex> lock(m_fileMutex);
+            std::swap(next, m_prepared);
+        }
+        if (!next.ctx) {
+            // Not prepared in time (very short segment, slow disk, stream
+            // just changed): open now, a late open in flight is dropped
+            m_syncSegmentOpens.fetchAndAddRelaxed(1);
+            m_outputGen.fetch_add(1);
+            next.path = nextSegmentPath();
+            QString error;
+            if (!openOutput(next.path, outputParams(), next.ctx, next.st, error)) {
+                qWarning() << "[REC]" << m_streamId << "cannot open next segment:" << error;
+                m_nextPending = false;
+                return false; // retry on next keyframe
+            }
+        }
+        m_nextPending = false;
+        closeRotatedSegment(m_outCtx, m_outStream, m_currentPath);
+
+        m_outCtx        = next.ctx;
+        m_outStream     = next.st;
+        m_currentPath   = next.path;
+        m_streamChanged = false;
+
+        m_recStartPts  = AV_NOPTS_VALUE;
+        m_fileHasKey   = false;
+        m_segmentTimer.start();
+        m_segmentBytes = 0;
+        m_segments.fetchAndAddRelaxed(1);
+
+        emit recordingStopped(m_streamId);
+        emit recordingStarted(m_streamId, m_currentPath);
+        qInfo() << "[REC]" << m_streamId << "new segment ->" << m_currentPath;
+        return true;
+    }
+
+    // Write (up to maxBytes of) the buffered pre-roll, oldest first
+    void flushPrebuffer(size_t maxBytes) {
+        size_t written = 0;
+        while (!m_prebuffer.empty() && written < maxBytes) {
+            const PrebufferRing::Entry &e = m_prebuffer.front();
+            writeBuffered(e);
+            written += static_cast<size_t>(e.size);
+            m_prebuffer.popFront();
+            ++m_prebufferSeq;
+        }
+        if (m_prebuffer.empty()) {
+            m_flushing = false;
+            clearPrebuffer();
+        }
+        updatePrebufferStats(false, 0.0);
+    }
+
+    // Common checks before filling m_pkt (left empty on success)
+    bool beginPacket(bool key) {
+        if (!m_recording || !m_outCtx || !m_outStream) return false;
+
+        // Empty prebuffer (pre_buffering_time 0, just reconnected...): the
+        // file still has to start on a keyframe
+        if (!m_fileHasKey) {
+            if (!key) {
+                ++m_leadingDropped;
+                m_leadingDroppedStat.storeRelease(m_leadingDropped);
+                return false;
+            }
+            m_fileHasKey = true;
+        }
 
         if (!m_pkt) {
             m_pkt = av_packet_alloc();
             if (!m_pkt) {
                 if(mVerboseLevel>0)
                     qWarning() << "[REC]" << m_streamId << "av_packet_alloc failed";
-                return;
+                return false;
             }
         }
-        // Reset to a clean state before reuse. Our data buffer is not
-        // reference-counted (buf == nullptr) so this never frees the QByteArray.
         av_packet_unref(m_pkt);
+        return true;
+    }
 
-        m_pkt->data = (uint8_t*)packet.data.constData();
-        m_pkt->size = packet.data.size();
-        m_pkt->flags = packet.key ? AV_PKT_FLAG_KEY : 0;
+    void muxPacket(int64_t pts, int64_t dts, int64_t duration, bool key, AVRational time_base) {
+        m_pkt->flags = key ? AV_PKT_FLAG_KEY : 0;
         m_pkt->stream_index = m_outStream->index;
 
-        int64_t src_pts = (packet.pts != AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+        int64_t src_pts = (pts != AV_NOPTS_VALUE) ? pts : dts;
         if (m_recStartPts == AV_NOPTS_VALUE && src_pts != AV_NOPTS_VALUE) {
             m_recStartPts = src_pts;
         }
 
-        if (packet.pts != AV_NOPTS_VALUE && m_recStartPts != AV_NOPTS_VALUE) {
-            m_pkt->pts = av_rescale_q(packet.pts - m_recStartPts,
-                                      packet.time_base,
+        if (pts != AV_NOPTS_VALUE && m_recStartPts != AV_NOPTS_VALUE) {
+            m_pkt->pts = av_rescale_q(pts - m_recStartPts,
+                                      time_base,
                                       m_outStream->time_base);
         } else {
             m_pkt->pts = AV_NOPTS_VALUE;
         }
 
-        if (packet.dts != AV_NOPTS_VALUE && m_recStartPts != AV_NOPTS_VALUE) {
-            m_pkt->dts = av_rescale_q(packet.dts - m_recStartPts,
-                                      packet.time_base,
+        if (dts != AV_NOPTS_VALUE && m_recStartPts != AV_NOPTS_VALUE) {
+            m_pkt->dts = av_rescale_q(dts - m_recStartPts,
+                                      time_base,
                                       m_outStream->time_base);
         } else {
             m_pkt->dts = AV_NOPTS_VALUE;
         }
 
-        if (packet.duration > 0) {
-            m_pkt->duration = av_rescale_q(packet.duration,
-                                           packet.time_base,
+        if (duration > 0) {
+            m_pkt->duration = av_rescale_q(duration,
+                                           time_base,
                                            m_outStream->time_base);
         } else {
             m_pkt->duration = 0;
         }
 
         m_pkt->pos = -1;
+        m_segmentBytes += m_pkt->size;
 
         int wret = av_interleaved_write_frame(m_outCtx, m_pkt);
         if (wret < 0) {
@@ -333,18 +1083,20 @@ private:
     void finalizeRecording() {
         if (!m_recording)
             return;
+        if (m_flushing)
+            flushPrebuffer(SIZE_MAX);
 
-        if (m_outCtx) {
-            av_write_trailer(m_outCtx);
-            if (!(m_outCtx->oformat->flags & AVFMT_NOFILE)) {
-                avio_closep(&m_outCtx->pb);
-            }
-            if (m_outStream && m_outStream->codecpar && m_outStream->codecpar->extradata) {
-                av_freep(&m_outStream->codecpar->extradata);
-            }
-            avformat_free_context(m_outCtx);
+        // Length of event recordings, for the next file's preallocation
+        if (m_segmentSec <= 0 && !m_continuous && m_segmentTimer.isValid()) {
+            const double sec = m_segmentTimer.elapsed() / 1000.0;
+            m_recordSecEma = (m_recordSecEma > 0.0) ? 0.7 * m_recordSecEma + 0.3 * sec : sec;
         }
-
+        // The file is truncated to its real size when closed (RecordFileIO)
+        if (m_outCtx)
+            m_lastFinalizeMs.storeRelease(closeOutput(m_outCtx, m_outStream));
+        // Prepared segment never used: removed on a file thread
+        discardPreparedSegment();
+        m_streamChanged = false;
 
 
         if (m_postStopTimer && m_postStopTimer->isActive())
@@ -0,0 +1,185 @@
+
+#ifndef __PacketQueue_H__
+#define __PacketQueue_H__
+
+#include "Utils.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+inline static const char *packetDropPolicyName(int policy) {
+    switch (policy) {
+    case PACKET_DROP_NONKEY: return "drop_nonkey";
+    case PACKET_BLOCK:       return "block";
+    default:                 return "drop_gop";
+    }
+}
+
+// Bounded lock-free single-producer/single-consumer ring of encoded packets
+// between one capture session and its recorder. Replaces the per-packet
+// queued signal: the producer only posts a wakeup to the consumer when the
+// queue goes from idle to non-empty, and the consumer drains in batches.
+//
+// Only a slot index crosses threads; packets are moved in and out, so the
+// payload is never copied (see AVPacketRef).
+class PacketQueue {
+public:
+    explicit PacketQueue(size_t capacity = 1024, int policy = PACKET_DROP_GOP)
+        : m_policy(policy)
+    {
+        size_t cap = 2;
+        while (cap < capacity)
+            cap <<= 1;
+        m_slots.resize(cap);
+        m_mask = cap - 1;
+    }
+
+    // Consumer wakeup, called from the producer thread. Must be cheap and
+    // thread-safe (e.g. a queued QMetaObject::invokeMethod).
+    void setConsumerWakeup(std::function<void()> fn) { m_wakeup = std::move(fn); }
+
+    // False when the producer is a shared thread (reactor worker) that must
+    // not wait for one recorder: a full queue then drops as drop_gop would.
+    // Set before the first push().
+    void setProducerCanBlock(bool c) { m_producerCanBlock = c; }
+
+    size_t capacity() const { return m_slots.size(); }
+    int policy() const { return m_policy; }
+
+    size_t depth() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    // Producer side. Returns false if the packet was dropped.
+    bool push(EncodedVideoPacket &&p) {
+        // After a drop the rest of the GOP cannot be decoded: skip to next key
+        if (m_skipUntilKey) {
+            if (!p.key) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            m_skipUntilKey = false;
+        }
+
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) >= m_slots.size()) {
+            const bool wait = m_producerCanBlock &&
+                              ((m_policy == PACKET_BLOCK) ||
+                               (m_policy == PACKET_DROP_NONKEY && p.key));
+            if (!wait || !waitForRoom(tail)) {
+                // The packets after this one refer to it: whatever the
+                // policy, the rest of the GOP goes too
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                m_skipUntilKey = true;
+                return false;
+            }
+        }
+
+        m_slots[tail & m_mask] = std::move(p);
+        m_tail.store(tail + 1, std::memory_order_release);
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+
+        const size_t d = tail + 1 - m_head.load(std::memory_order_acquire);
+        if (d > m_maxDepth.load(std::memory_order_relaxed))
+            m_maxDepth.store(d, std::memory_order_relaxed);
+
+        // Pairs with the fence in drain(): either the consumer sees our
+        // tail, or we see its cleared flag and post a wakeup.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_wakeupPending.exchange(true) && m_wakeup)
+            m_wakeup();
+        return true;
+    }
+
+    // Consumer side. Calls fn(EncodedVideoPacket&) for up to maxBatch packets
+    // in FIFO order and returns how many were handled. If packets remain, a
+    // new wakeup is posted so other work queued on the consumer's thread
+    // gets a turn in between batches.
+    template <class F>
+    size_t drain(F &&fn, size_t maxBatch = 256) {
+        m_wakeupPending.store(false);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        size_t n = 0;
+        size_t head = m_head.load(std::memory_order_relaxed);
+        while (n < maxBatch) {
+            if (head == m_tail.load(std::memory_order_acquire))
+                break;
+            EncodedVideoPacket p = std::move(m_slots[head & m_mask]);
+            m_slots[head & m_mask] = EncodedVideoPacket();
+            m_head.store(++head, std::memory_order_release);
+            // Pairs with the fence in waitForRoom(): either the producer sees
+            // our head, or we see it waiting and signal it.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_producerWaiting.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(m_roomMutex);
+                m_roomCond.notify_one();
+            }
+            fn(p);
+            ++n;
+        }
+        if (n > 0)
+            m_batches.fetch_add(1, std::memory_order_relaxed);
+
+        if (head != m_tail.load(std::memory_order_acquire) &&
+            !m_wakeupPending.exchange(true) && m_wakeup)
+            m_wakeup();
+        return n;
+    }
+
+    sl::json statsJson() const {
+        sl::json j;
+        j["capacity"]  = static_cast<uint64_t>(capacity());
+        j["policy"]    = packetDropPolicyName(m_policy);
+        j["depth"]     = static_cast<uint64_t>(depth());
+        j["max_depth"] = static_cast<uint64_t>(m_maxDepth.load(std::memory_order_relaxed));
+        j["pushed"]    = m_pushed.load(std::memory_order_relaxed);
+        j["dropped"]   = m_dropped.load(std::memory_order_relaxed);
+        j["batches"]   = m_batches.load(std::memory_order_relaxed);
+        return j;
+    }
+
+private:
+    bool waitForRoom(size_t tail) {
+        // Backpressure: the capture thread sleeps until drain() frees a slot
+        // instead of growing memory. Bounded so that a wedged recorder cannot
+        // hold the camera forever.
+        auto hasRoom = [this, tail]() {
+            return tail - m_head.load(std::memory_order_acquire) < m_slots.size();
+        };
+        std::unique_lock<std::mutex> lock(m_roomMutex);
+        m_producerWaiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const bool room = m_roomCond.wait_for(lock, std::chrono::milliseconds(kBlockTimeoutMs), hasRoom);
+        m_producerWaiting.store(false, std::memory_order_relaxed);
+        return room;
+    }
+
+    std::vector<EncodedVideoPacket> m_slots;
+    size_t m_mask{0};
+    int    m_policy{PACKET_DROP_GOP};
+    std::function<void()> m_wakeup;
+
+    alignas(64) std::atomic<size_t> m_head{0}; // written by consumer only
+    alignas(64) std::atomic<size_t> m_tail{0}; // written by producer only
+    bool m_skipUntilKey{false};                // producer only
+    bool m_producerCanBlock{true};
+    std::atomic_bool m_wakeupPending{false};
+
+    // Producer waiting for room (blocking policies)
+    std::atomic_bool        m_producerWaiting{false};
+    std::mutex              m_roomMutex;
+    std::condition_variable m_roomCond;
+
+    std::atomic<uint64_t> m_pushed{0};
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_batches{0};
+    std::atomic<size_t>   m_maxDepth{0};
+
+    static constexpr int kBlockTimeoutMs = 2000;
+};
+
+#endif /* __PacketQueue_H__ */
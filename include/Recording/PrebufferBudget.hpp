@@ -0,0 +1,54 @@
+#ifndef __PrebufferBudget_H__
+#define __PrebufferBudget_H__
+
+#include "Utils.hpp"
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide memory budget for the pre-record buffers of all streams.
+// Each recorder reports, once per GOP, what it needs to hold its pre-roll
+// (measured bitrate x (pre_buffering_time + one GOP)) and the memory its
+// buffer currently holds; the budget splits the total in proportion to the
+// needs and returns the stream's share. A recorder over its share drops its
+// oldest GOPs and reports a trim.
+class PrebufferBudget {
+public:
+    // totalBytes <= 0: no global limit (accounting only)
+    explicit PrebufferBudget(qint64 totalBytes = 0);
+
+    void registerStream(const QString &streamId);
+
+    // Returns the bytes the stream may use (-1 = unlimited)
+    qint64 report(const QString &streamId, qint64 neededBytes, qint64 usedBytes);
+
+    // The stream dropped pre-roll it needed to stay within its share
+    void noteTrim(const QString &streamId);
+
+    qint64 totalBytes() const { return m_total; }
+
+    sl::json statsJson() const;
+
+    // Share floor for streams not measured yet (no bitrate estimate)
+    static constexpr qint64 kMinNeededBytes = 1024 * 1024;
+
+private:
+    struct Entry {
+        std::string id;
+        qint64      needed{0};
+        qint64      allowed{-1};
+        qint64      used{0};
+        qint64      highWater{0};
+        quint64     trims{0};
+    };
+
+    Entry *find(const QString &streamId); // m_mutex held
+    void rebalance();                     // m_mutex held
+
+    qint64             m_total;
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+    qint64             m_usedHighWater{0};
+};
+
+#endif /* __PrebufferBudget_H__ */
@@ -0,0 +1,307 @@
+#ifndef __PrebufferRing_H__
+#define __PrebufferRing_H__
+
+#include "Utils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Pre-record buffer of one stream: packet payloads are copied into a single
+// contiguous byte ring and described by a compact circular index, so the
+// steady state (append newest / drop oldest) does no allocation at all and
+// the demuxer's packet buffers are released as soon as they are queued.
+//
+// Payloads never wrap: a packet that does not fit before the end of the
+// byte ring is placed at its start (the tail gap is left unused until the
+// oldest packets are dropped). Recorder thread only.
+//
+// For long pre-rolls the byte ring can be a fixed-size mmap'ed file instead
+// (openFile()): only the index stays in memory. Written and consumed
+// regions are written back and dropped from the page cache in kSpillChunk
+// steps, without ever waiting for the disk, so minutes of 4K video do not
+// evict the rest of the system's cache.
+class PrebufferRing {
+public:
+    struct Entry {
+        size_t     offset   = 0;
+        int        size     = 0;
+        int64_t    pts      = AV_NOPTS_VALUE;
+        int64_t    dts      = AV_NOPTS_VALUE;
+        int64_t    duration = 0;
+        AVRational time_base{1, 1};
+        bool       key      = false;
+    };
+
+    explicit PrebufferRing(size_t maxCapacity) : m_maxCapacity(maxCapacity) {}
+    ~PrebufferRing() { closeFile(); }
+
+    PrebufferRing(const PrebufferRing &) = delete;
+    PrebufferRing &operator=(const PrebufferRing &) = delete;
+
+    // Switch to a disk-backed ring of 'bytes' (buffered packets are lost).
+    // The file is unlinked right away: the space is given back on close or
+    // crash. Returns false (ring stays in memory) if not supported or the
+    // space cannot be reserved.
+    bool openFile(const QString &path, size_t bytes) {
+#if defined(_WIN32)
+        Q_UNUSED(path); Q_UNUSED(bytes);
+        return false;
+#else
+        const QByteArray p = path.toUtf8();
+        int fd = ::open(p.constData(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+            return false;
+        ::unlink(p.constData());
+        // Reserve the blocks: a write fault on a sparse mapping of a full
+        // disk would be a SIGBUS
+        if (posix_fallocate(fd, 0, static_cast<off_t>(bytes)) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void *base = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        ::madvise(base, bytes, MADV_SEQUENTIAL);
+
+        closeFile();
+        clear();
+        std::vector<uint8_t>().swap(m_buf);
+        m_fd          = fd;
+        m_base        = static_cast<uint8_t*>(base);
+        m_cap         = bytes;
+        m_maxCapacity = bytes;
+        return true;
+#endif
+    }
+
+    bool   isFileBacked() const { return m_fd >= 0; }
+
+    size_t size() const     { return m_count; }
+    bool   empty() const    { return m_count == 0; }
+    size_t bytes() const    { return m_bytes; }
+    size_t capacity() const { return m_cap; }
+    quint64 reallocs() const { return m_reallocs; }
+    size_t maxCapacity() const { return m_maxCapacity; }
+
+    // Lower (or raise) the size limit. Does not drop packets: a ring above
+    // the new limit shrinks on the next reserve() once the caller trimmed it.
+    void setMaxCapacity(size_t bytes) { m_maxCapacity = bytes; }
+
+    const Entry &front() const { return at(0); }
+    const Entry &at(size_t i) const { return m_index[(m_first + i) % m_index.size()]; }
+    const uint8_t *data(const Entry &e) const { return m_base + e.offset; }
+
+    // Packets push() accepts at all (payload present)
+    static bool storable(const EncodedVideoPacket &p) { return p.size() > 0 && p.data(); }
+
+    // O(1), no allocation unless the rings must grow. Returns false if the
+    // packet does not fit within maxCapacity: the caller drops old packets
+    // and tries again. The packet must be storable().
+    bool push(const EncodedVideoPacket &p) {
+        if (!storable(p))
+            return false;
+        const int n = p.size();
+
+        size_t offset = 0;
+        if (!place(static_cast<size_t>(n), offset)) {
+            if (!grow(m_bytes + static_cast<size_t>(n)) ||
+                !place(static_cast<size_t>(n), offset))
+                return false;
+        }
+        if (m_count == m_index.size())
+            growIndex();
+
+        std::memcpy(m_base + offset, p.data(), static_cast<size_t>(n));
+        if (isFileBacked())
+            m_written.add(*this, offset, static_cast<size_t>(n), true);
+        Entry &e    = m_index[(m_first + m_count) % m_index.size()];
+        e.offset    = offset;
+        e.size      = n;
+        e.pts       = p.pts;
+        e.dts       = p.dts;
+        e.duration  = p.duration;
+        e.time_base = p.time_base;
+        e.key       = p.key;
+        ++m_count;
+        m_bytes += static_cast<size_t>(n);
+        return true;
+    }
+
+    void popFront() {
+        if (m_count == 0)
+            return;
+        if (isFileBacked())
+            m_consumed.add(*this, front().offset, static_cast<size_t>(front().size), false);
+        m_bytes -= static_cast<size_t>(front().size);
+        m_first = (m_first + 1) % m_index.size();
+        if (--m_count == 0)
+            m_first = 0;
+    }
+
+    void clear() {
+        m_count = 0;
+        m_first = 0;
+        m_bytes = 0;
+    }
+
+    // Resize the byte ring to 'target' (clamped to maxCapacity, but never
+    // below what is buffered). Called rarely, from the measured bitrate.
+    void reserve(size_t target) {
+        if (isFileBacked())
+            return; // fixed size
+        target = std::max(std::min(target, m_maxCapacity), m_bytes);
+        if (target != m_buf.size())
+            relocate(target);
+    }
+
+private:
+    // Contiguous room for n bytes after the newest packet
+    bool place(size_t n, size_t &offset) const {
+        if (n > m_cap)
+            return false;
+        if (m_count == 0) {
+            offset = 0;
+            return true;
+        }
+        const Entry &first = front();
+        const Entry &last  = at(m_count - 1);
+        const size_t end   = last.offset + static_cast<size_t>(last.size);
+        if (last.offset >= first.offset) {
+            // [first, end) in use: room after it, else wrap to the start
+            if (m_cap - end >= n)        { offset = end; return true; }
+            if (first.offset >= n)       { offset = 0;   return true; }
+            return false;
+        }
+        // Wrapped: room between the newest and the oldest packet
+        if (first.offset - end >= n) { offset = end; return true; }
+        return false;
+    }
+
+    // At maxCapacity the ring is full: the caller drops old packets rather
+    // than have every push copy the whole ring to close the wrap gap
+    bool grow(size_t needed) {
+        if (isFileBacked() || needed > m_maxCapacity || m_cap >= m_maxCapacity)
+            return false;
+        size_t cap = std::max<size_t>(m_cap * 2, kMinCapacity);
+        while (cap < needed)
+            cap *= 2;
+        relocate(std::min(cap, m_maxCapacity));
+        return true;
+    }
+
+    // Copy the buffered packets to the start of a new byte ring
+    void relocate(size_t cap) {
+        std::vector<uint8_t> buf(cap);
+        size_t offset = 0;
+        for (size_t i = 0; i < m_count; ++i) {
+            Entry &e = m_index[(m_first + i) % m_index.size()];
+            std::memcpy(buf.data() + offset, m_base + e.offset, static_cast<size_t>(e.size));
+            e.offset = offset;
+            offset  += static_cast<size_t>(e.size);
+        }
+        m_buf.swap(buf);
+        m_base = m_buf.data();
+        m_cap  = m_buf.size();
+        ++m_reallocs;
+    }
+
+    void closeFile() {
+#if !defined(_WIN32)
+        if (m_fd < 0)
+            return;
+        ::munmap(m_base, m_cap);
+        ::close(m_fd);
+        m_fd   = -1;
+        m_base = nullptr;
+        m_cap  = 0;
+        m_written  = Span();
+        m_consumed = Span();
+#endif
+    }
+
+    // Contiguous file region written (or consumed) since the last spill. A
+    // full chunk starts its writeback; the chunk before it, written back by
+    // now, is dropped from the mapping and the page cache. Nothing waits for
+    // the disk: pages still dirty stay cached and are evicted by the kernel.
+    struct Span {
+        size_t off = 0, len = 0;         // current chunk
+        size_t prevOff = 0, prevLen = 0; // chunk waiting to be dropped
+
+        void add(PrebufferRing &r, size_t o, size_t n, bool writeback) {
+            if (len > 0 && (o != off + len || len >= kSpillChunk)) {
+                if (writeback)
+                    r.startWriteback(off, len);
+                r.dropPages(prevOff, prevLen);
+                prevOff = off;
+                prevLen = len;
+                len = 0;
+            }
+            if (len == 0)
+                off = o;
+            len += n;
+        }
+    };
+
+    void startWriteback(size_t off, size_t len) {
+#if defined(__linux__)
+        sync_file_range(m_fd, static_cast<off_t>(off), static_cast<off_t>(len), SYNC_FILE_RANGE_WRITE);
+#else
+        Q_UNUSED(off); Q_UNUSED(len);
+#endif
+    }
+
+    // Unmapping keeps the data of a shared mapping (dirty pages stay in the
+    // page cache) and FADV_DONTNEED skips the pages not written back yet,
+    // so this only ever drops clean pages and never blocks
+    void dropPages(size_t off, size_t len) {
+#if !defined(_WIN32)
+        if (len == 0)
+            return;
+        // Whole pages only: the neighbours may still be in use
+        const size_t first = (off + kPage - 1) & ~(kPage - 1);
+        const size_t last  = (off + len) & ~(kPage - 1);
+        if (last <= first)
+            return;
+        ::madvise(m_base + first, last - first, MADV_DONTNEED);
+        posix_fadvise(m_fd, static_cast<off_t>(first), static_cast<off_t>(last - first), POSIX_FADV_DONTNEED);
+#else
+        Q_UNUSED(off); Q_UNUSED(len);
+#endif
+    }
+
+    void growIndex() {
+        std::vector<Entry> index(std::max<size_t>(m_index.size() * 2, kMinEntries));
+        for (size_t i = 0; i < m_count; ++i)
+            index[i] = at(i);
+        m_index.swap(index);
+        m_first = 0;
+    }
+
+    static constexpr size_t kMinCapacity = 256 * 1024;
+    static constexpr size_t kMinEntries  = 256;
+    static constexpr size_t kSpillChunk  = 4 * 1024 * 1024;
+    static constexpr size_t kPage        = 4096;
+
+    std::vector<uint8_t> m_buf;  // memory ring
+    uint8_t *m_base = nullptr;   // m_buf.data() or the file mapping
+    size_t   m_cap  = 0;
+    int      m_fd   = -1;        // file-backed ring
+    Span     m_written;
+    Span     m_consumed;
+    std::vector<Entry>   m_index;
+    size_t  m_first = 0;       // index slot of the oldest packet
+    size_t  m_count = 0;
+    size_t  m_bytes = 0;       // payload bytes buffered (gaps excluded)
+    size_t  m_maxCapacity;
+    quint64 m_reallocs = 0;
+};
+
+#endif /* __PrebufferRing_H__ */
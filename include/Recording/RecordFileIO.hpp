@@ -0,0 +1,123 @@
+#ifndef __RecordFileIO_H__
+#define __RecordFileIO_H__
+
+#include "Utils.hpp"
+#include <QFile>
+#include <vector>
+
+// FFmpeg 7 (lavf 61) made the AVIO write callback buffer const
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+using AvioWriteBuffer = const uint8_t *;
+#else
+using AvioWriteBuffer = uint8_t *;
+#endif
+
+// Write counters of one recorder, all its files (atomics, any thread)
+struct RecordIoStats {
+    QAtomicInteger<quint64> writeCalls{0};   // write() syscalls
+    QAtomicInteger<quint64> bytesWritten{0};
+    QAtomicInteger<quint64> seeks{0};        // muxer seek requests
+    QAtomicInteger<quint64> seekFlushes{0};  // seeks outside the buffer (forced a write)
+    QAtomicInteger<quint64> directWrites{0}; // O_DIRECT writes (direct policy)
+    QAtomicInteger<quint64> cacheDrops{0};   // ranges dropped from the page cache
+    QAtomicInteger<quint64> preallocBytes{0};   // reserved with fallocate
+    QAtomicInteger<quint64> preallocFailed{0};  // fallocate refused (filesystem)
+    QAtomicInteger<quint64> filesClosed{0};
+    QAtomicInteger<quint64> extentsTotal{0};    // over filesClosed (FIEMAP, Linux)
+    QAtomicInteger<quint64> extentsLast{0};
+    QAtomicInteger<quint64> extentsMax{0};
+
+    sl::json statsJson() const;
+};
+
+// Output file of a recording behind a custom AVIOContext. The muxer's small
+// writes are coalesced in a large per-file buffer and reach the disk as few
+// big write() calls, which keeps hundreds of concurrent recordings from
+// interleaving tiny writes on spinning disks and NAS mounts.
+//
+// The buffer holds one contiguous dirty range of the file. Seek-backs from
+// the muxer (mdat size, moov patching) that land inside it are applied in
+// memory; anywhere else the buffer is written out first.
+//
+// Page cache (RecordCachePolicy): with "dontneed" the written data starts
+// its writeback every few MB (never waiting for it) and the range started
+// two ranges earlier, written back by then, is dropped from the cache, so a
+// 24/7 recorder neither fills the cache nor flushes it in large stalls. "direct" also writes the whole blocks of the
+// buffer with O_DIRECT (the buffer keeps file offset = memory offset modulo
+// the block size, so they are aligned in both); the unaligned head and tail
+// and the muxer's patches go through the cache as with "dontneed".
+//
+// Preallocation (Linux): the expected size of the file is reserved up front
+// without changing its visible size (FALLOC_FL_KEEP_SIZE), and again in
+// steps when it outgrows it, so concurrent recordings in one folder get
+// long extents instead of interleaved ones. close() gives the unused tail
+// back and counts the extents of the file.
+class RecordFileIO {
+public:
+    RecordFileIO(size_t bufferBytes, RecordIoStats *stats, int cachePolicy = RECORD_CACHE_NORMAL);
+    ~RecordFileIO();
+
+    RecordFileIO(const RecordFileIO &) = delete;
+    RecordFileIO &operator=(const RecordFileIO &) = delete;
+
+    // Create/truncate 'path' and the AVIOContext writing to it
+    bool open(const QString &path);
+
+    // Reserve 'bytes' now, then 'stepBytes' at a time when writes reach the
+    // end of the reservation. Call after open(); no-op if not supported.
+    void preallocate(int64_t bytes, int64_t stepBytes);
+
+    AVIOContext *avio() const { return m_avio; }
+
+    // Flush everything, free the AVIOContext and close the file.
+    // Returns false if a write failed at any point.
+    bool close();
+
+    // The RecordFileIO behind a custom AVIOContext created by open()
+    static RecordFileIO *fromAvio(AVIOContext *pb) { return static_cast<RecordFileIO*>(pb->opaque); }
+
+private:
+    static int     writeCallback(void *opaque, AvioWriteBuffer buf, int size);
+    static int64_t seekCallback(void *opaque, int64_t offset, int whence);
+
+    int     write(const uint8_t *data, int size);
+    int64_t seek(int64_t offset, int whence);
+    bool    flushBuffer(bool all = true);
+    bool    writeAt(int64_t pos, const uint8_t *data, size_t size);
+    bool    writeDirect(int64_t pos, const uint8_t *data, size_t size);
+    void    resetBuffer(int64_t pos);
+    void    releaseCache(int64_t pos, size_t size);
+    void    startWriteback();
+    void    dropCacheRange(int64_t pos, size_t size);
+    void    reserveUpTo(int64_t end);
+    void    releasePreallocation();
+
+    static constexpr int    kAvioBufferSize = 64 * 1024; // FFmpeg side, copied into m_buf
+    static constexpr size_t kBlock          = 4096;      // O_DIRECT alignment
+    static constexpr size_t kCacheReleaseBytes = 4 * 1024 * 1024; // writeback/drop granularity
+
+    QFile                m_file;
+    AVIOContext         *m_avio = nullptr;
+    std::vector<uint8_t> m_storage;       // m_buf + alignment slack
+    uint8_t             *m_buf      = nullptr; // kBlock aligned
+    size_t               m_bufCap   = 0;
+    size_t               m_skew     = 0;  // m_bufStart % kBlock (direct), data starts at m_buf + m_skew
+    int64_t              m_bufStart = 0;  // file offset of m_buf[m_skew]
+    size_t               m_bufLen   = 0;
+    int64_t              m_pos      = 0; // muxer position
+    int64_t              m_size     = 0; // logical file size
+    bool                 m_failed   = false;
+    RecordIoStats       *m_stats;
+    int                  m_policy;
+    int                  m_directFd = -1;
+    int64_t              m_relPos  = 0;  // written, writeback not started yet
+    size_t               m_relSize = 0;
+    int64_t              m_wbPos  = 0;   // range whose writeback was started last
+    size_t               m_wbSize = 0;
+    int64_t              m_wbPrevPos  = 0; // the one before, dropped at the next start
+    size_t               m_wbPrevSize = 0;
+    int64_t              m_allocEnd  = 0; // end of the fallocate'd range
+    int64_t              m_allocStep = 0; // 0 = no preallocation
+};
+
+#endif /* __RecordFileIO_H__ */
@@ -0,0 +1,74 @@
+#ifndef __RecorderPool_H__
+#define __RecorderPool_H__
+
+#include "Utils.hpp"
+#include <QThread>
+#include <QThreadPool>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class Mp4RecorderWorker;
+
+// Drain counters of one writer thread, updated by its recorders
+struct RecorderThreadStats {
+    QAtomicInteger<int>     recorders{0};
+    QAtomicInteger<quint64> drains{0};      // batches handled
+    QAtomicInteger<quint64> packets{0};
+    QAtomicInteger<quint64> busyUs{0};      // time spent draining
+    QAtomicInteger<quint64> waitUsTotal{0}; // queue wakeup -> drain start
+    QAtomicInteger<qint64>  waitUsMax{0};
+
+    void noteDrain(qint64 waitUs, qint64 busyUs, size_t packets);
+    sl::json statsJson() const;
+
+    static qint64 nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// Runs the recorders on a small fixed pool of writer threads instead of one
+// QThread per camera. A recorder stays on its thread for good: its packets,
+// timers and control slots are serialized there, so per-stream order holds.
+// Each thread's event loop services its recorders in wakeup order, and a
+// drain handles at most Mp4RecorderWorker::kDrainBatch packets before it
+// queues itself again behind the other recorders of the thread, so a busy
+// stream cannot starve the others. File work that can take long (opening
+// the next segment ahead, the trailer of a rotated classic MP4) runs on a
+// few separate file threads instead, so it never holds a writer thread.
+class RecorderPool {
+public:
+    // threads <= 0 picks idealThreadCount; never more than 'recorders'
+    RecorderPool(int threads, int recorders);
+    ~RecorderPool();
+
+    // Moves the recorder to the least loaded thread. The pool owns it from
+    // then on (deleted when its thread finishes).
+    void addRecorder(Mp4RecorderWorker *recorder);
+
+    // Run on a file thread (any thread may call it)
+    void runFileTask(std::function<void()> task);
+
+    void start();
+    void stop();
+
+    int threadCount() const { return static_cast<int>(m_workers.size()); }
+
+    sl::json statsJson() const;
+
+private:
+    struct Worker {
+        QThread            *thread{nullptr};
+        RecorderThreadStats stats;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    QThreadPool                          m_fileThreads;
+    bool                                 m_running{false};
+
+    static constexpr int kFileThreads = 2;
+};
+
+#endif /* __RecorderPool_H__ */
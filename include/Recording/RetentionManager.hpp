@@ -0,0 +1,101 @@
+#ifndef __RetentionManager_H__
+#define __RetentionManager_H__
+
+#include "Utils.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Deletes old recordings of the recording folder, oldest first:
+//  - per stream, files older than maxAgeHours or beyond maxMb in total;
+//  - all streams, while free space is below minFreePct, until targetFreePct.
+// Files are taken from an in-memory index: the folder is scanned once at
+// start(), then the recorders report each file they open and close, so a
+// pass never lists the directory. A stream's file being recorded is never
+// deleted. Passes run on one low-priority thread (lowest best-effort I/O
+// priority on Linux) and deletions are rate limited, so they do not compete
+// with recording writes. Thread-safe.
+class RetentionManager {
+public:
+    struct Rules {
+        int minFreePct     = 0; // 0 = no free-space rule
+        int targetFreePct  = 0;
+        int deletesPerSec  = 4;
+    };
+
+    RetentionManager(const QString &folder, const Rules &rules);
+    ~RetentionManager();
+
+    // Before start(). 0 = no limit.
+    void addStream(const QString &streamId, int maxAgeHours, int maxMb);
+
+    // Scan the folder once and start the thread (no-op without any rule)
+    void start();
+    void stop();
+
+    // From the recorders (any thread): a file is being written / done
+    void onRecordingStarted(const QString &streamId, const QString &filePath);
+    void onRecordingStopped(const QString &streamId);
+
+    bool enabled() const;
+
+    sl::json statsJson() const;
+
+    static constexpr int kPassIntervalMs = 10000;
+    static constexpr int kMinFileAgeSec  = 60; // just closed: trailer may still be written
+
+private:
+    struct File {
+        QString path;
+        qint64  time{0};  // last write, seconds since epoch
+        qint64  size{-1}; // -1 = not known yet (stat'ed by the next pass)
+    };
+
+    struct Stream {
+        std::string      id;
+        QString          prefix;      // "rec_<id>_"
+        qint64           maxAgeSec{0};
+        qint64           maxBytes{0};
+        std::deque<File> files;       // oldest first
+        QString          current;     // being recorded, not in 'files'
+        qint64           bytes{0};    // known sizes of 'files'
+        quint64          deleted{0};
+    };
+
+    enum Reason { REASON_AGE, REASON_SIZE, REASON_SPACE };
+
+    void    scanFolder();
+    Stream *streamForFile(const QString &fileName); // m_mutex held
+    void    addFile(Stream &s, File f);             // m_mutex held
+    void    threadLoop();
+    bool    runPass();                              // true if it deleted something
+    bool    deleteOldest(Stream *s, Reason reason);
+    int     freePct();
+    bool    waitMs(int ms);                          // false when stopping
+
+    QString                 m_folder;
+    Rules                   m_rules;
+    mutable std::mutex      m_mutex;
+    std::vector<Stream>     m_streams;
+    std::thread             m_thread;
+    std::atomic_bool        m_running{false};
+    std::mutex              m_wakeMutex;
+    std::condition_variable m_wakeCond;
+    bool                    m_wake{false};
+
+    std::atomic<uint64_t>   m_deletedFiles{0};
+    std::atomic<uint64_t>   m_deletedBytes{0};
+    std::atomic<uint64_t>   m_deletedByAge{0};
+    std::atomic<uint64_t>   m_deletedBySize{0};
+    std::atomic<uint64_t>   m_deletedBySpace{0};
+    std::atomic<uint64_t>   m_deleteErrors{0};
+    std::atomic<int>        m_lastFreePct{-1};
+    std::atomic<int64_t>    m_lastPassMs{-1};
+    std::atomic<int64_t>    m_maxDeleteMs{0};
+};
+
+#endif /* __RetentionManager_H__ */
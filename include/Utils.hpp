@@ -25,6 +25,7 @@ extern "C" {
 #include <sstream>
 #include <deque>
 #include <cmath>
+#include <memory>
 
 #include <QFile>
 #include "Http/json.hpp"   // from nlohmann::json
@@ -33,15 +34,32 @@ extern "C" {
 
 #define APP_VERSION "0.2.5"
 
+// Refcounted handle on a demuxed AVPacket. Copying it (including Qt's
+// queued-signal marshalling) only bumps a refcount; the payload bytes are
+// shared from the demuxer all the way to av_interleaved_write_frame().
+using AVPacketRef = std::shared_ptr<AVPacket>;
+
+// Moves src's reference into a new packet handle (src is left blank).
+inline static AVPacketRef makePacketRef(AVPacket *src) {
+    AVPacket *p = av_packet_alloc();
+    if (!p)
+        return AVPacketRef();
+    av_packet_move_ref(p, src);
+    return AVPacketRef(p, [](AVPacket *x) { av_packet_free(&x); });
+}
+
 // ---------------- EncodedVideoPacket (for signals) ----------------
 struct EncodedVideoPacket {
     QString  streamId;
-    QByteArray data;
+    AVPacketRef packet;   // shared, read-only payload
     int64_t pts = AV_NOPTS_VALUE;
     int64_t dts = AV_NOPTS_VALUE;
     int64_t duration = 0;
     bool   key = false;
     AVRational time_base{1,1};
+
+    const uint8_t *data() const { return packet ? packet->data : nullptr; }
+    int size() const { return packet ? packet->size : 0; }
 };
 
 struct StreamInfo {
@@ -108,9 +126,63 @@ static QString makeRecordFilename(const QString& streamId, const QString& folder
 }
 
 
+// FFmpeg decoder threading flavour (AVCodecContext::thread_type)
+enum DecoderThreadType {
+    DECODER_THREAD_AUTO  = 0, // slice + frame (frame threading only with > 1 thread)
+    DECODER_THREAD_SLICE = 1, // slice only: no added latency, helps multi-slice streams
+    DECODER_THREAD_FRAME = 2  // frame only: scales on any stream, +1 frame latency per thread
+};
+
+// What recording files leave in the OS page cache
+enum RecordCachePolicy {
+    RECORD_CACHE_NORMAL   = 0, // kernel default (written data stays cached, bursty writeback)
+    RECORD_CACHE_DONTNEED = 1, // steady writeback + drop written ranges from the cache
+    RECORD_CACHE_DIRECT   = 2  // O_DIRECT for whole blocks, rest as dontneed (Linux)
+};
+
+// Which frames are decoded for the display (the recorder always gets every packet)
+enum PreviewDecodeMode {
+    PREVIEW_DECODE_ALL    = 0, // every frame
+    PREVIEW_DECODE_NONREF = 1, // skip non-reference frames (AVDISCARD_NONREF)
+    PREVIEW_DECODE_KEY    = 2  // keyframes only: ~1 fps per GOP, single-threaded decoder
+};
+
+inline static bool parsePreviewDecodeMode(const std::string &s, int &mode)
+{
+    if (s == "all")
+        mode = PREVIEW_DECODE_ALL;
+    else if (s == "nonref")
+        mode = PREVIEW_DECODE_NONREF;
+    else if (s == "key")
+        mode = PREVIEW_DECODE_KEY;
+    else
+        return false;
+    return true;
+}
+
 struct StreamConfig {
     QString id;
     QString url;
+    QString previewUrl;     // optional low-res substream, decoded for the display instead of url
+    int decoderThreads = 0; // 0 = auto (granted from decoder_core_budget)
+    int decoderThreadType = DECODER_THREAD_AUTO;
+    int priority = 0;       // connect admission order (higher first)
+    int previewDecode = PREVIEW_DECODE_ALL; // defaults to the global preview_decode
+    int maxAgeHours = 0;    // retention, defaults to retention_max_age_hours (0 = keep)
+    int maxMb = 0;          // retention, defaults to retention_max_mb (0 = no limit)
+};
+
+// Capture engine layout
+enum CaptureEngine {
+    CAPTURE_ENGINE_THREAD  = 0, // one RtspCaptureThread (QThread) per stream
+    CAPTURE_ENGINE_REACTOR = 1  // all streams multiplexed on a CaptureReactor I/O pool
+};
+
+// What the capture side does when a stream's packet queue is full
+enum PacketDropPolicy {
+    PACKET_DROP_GOP    = 0, // drop the packet and the rest of its GOP (resume on next keyframe)
+    PACKET_DROP_NONKEY = 1, // never drop a keyframe (it waits for room); a dropped non-key packet drops the rest of its GOP
+    PACKET_BLOCK       = 2  // wait for the recorder (bounded, then falls back to drop_gop)
 };
 
 struct AppConfig {
@@ -122,6 +194,32 @@ struct AppConfig {
     float postbufferingTime = 0.5;
     QString rec_base_folder = "./";
     int loglevel=0; //0 = few log, 1 = medium, 2=high
+    int captureEngine = CAPTURE_ENGINE_THREAD;
+    int captureIoThreads = 0; // reactor only, 0 = auto
+    int recorderThreads = 0;  // writer threads shared by all recorders, 0 = cores
+    int packetQueueSize = 1024; // packets between capture and recorder, per stream
+    int packetQueuePolicy = PACKET_DROP_GOP;
+    int decoderCoreBudget = 0; // decoder threads shared by "auto" streams, 0 = cores
+    int probeCache = 1;        // reuse last known stream parameters on (re)connect
+    QString probeCacheFolder;  // persist them there (empty = memory only)
+    int maxConcurrentConnects = 8; // RTSP opens (handshake + probe) at the same time, 0 = unlimited
+    int previewDecode = PREVIEW_DECODE_ALL; // default for streams without their own preview_decode
+    int prebufferBudgetMb = 0; // pre-record memory shared by all streams, 0 = no global limit
+    QString prebufferDiskFolder; // disk-backed prebuffers there (empty = memory)
+    int prebufferDiskMb = 1024;  // disk prebuffer size per stream
+    int mp4Fragmented = 0;       // 1 = fragmented MP4 (crash-safe, playable while recording)
+    int mp4FragmentMs = 1000;    // max fragment duration (fragments also start at keyframes)
+    int continuousRecording = 0; // 1 = record all streams as soon as they are up
+    int segmentMinutes = 0;      // roll to a new file every N minutes (0 = off)
+    int segmentMb = 0;           // ... or every N MB (0 = off)
+    int recordWriteBufferKb = 1024; // write-coalescing buffer per recording file (0 = FFmpeg default I/O)
+    int recordCachePolicy = RECORD_CACHE_NORMAL; // page cache use of the recording folder
+    int recordPreallocate = 1;   // reserve each file's expected size (fallocate, Linux)
+    int retentionMinFreePct = 0;    // delete oldest recordings below this free space (0 = off)
+    int retentionTargetFreePct = 0; // ... until this much is free (0 = min + 5)
+    int retentionMaxAgeHours = 0;   // per-stream defaults, 0 = no limit
+    int retentionMaxMb = 0;
+    int retentionDeletesPerSec = 4;
 };
 
 inline static bool loadConfigFile(const QString &path,
@@ -213,6 +311,201 @@ inline static bool loadConfigFile(const QString &path,
         else
           qWarning() << "[CFG] post_buffering_time entry not found in config. Using Default = "<<config.postbufferingTime;
 
+        /// Capture engine ("thread" or "reactor")
+        config.captureEngine = CAPTURE_ENGINE_THREAD;
+        if (j.contains("capture_engine") && j["capture_engine"].is_string()) {
+            const std::string e = j["capture_engine"].get<std::string>();
+            if (e == "reactor")
+                config.captureEngine = CAPTURE_ENGINE_REACTOR;
+            else if (e != "thread")
+                qWarning() << "[CFG] Unknown capture_engine" << e.c_str() << ". Using Default = thread";
+        }
+        else
+            qWarning() << "[CFG] capture_engine entry not found in config. Using Default = thread";
+
+        /// Reactor I/O threads
+        config.captureIoThreads = 0;
+        if (j.contains("capture_io_threads") && j["capture_io_threads"].is_number_integer()) {
+            int p = j["capture_io_threads"].get<int>();
+            if (p >= 0)
+                config.captureIoThreads = p;
+        }
+
+        /// Recorder writer threads
+        config.recorderThreads = 0;
+        if (j.contains("recorder_threads") && j["recorder_threads"].is_number_integer()) {
+            int p = j["recorder_threads"].get<int>();
+            if (p >= 0)
+                config.recorderThreads = p;
+        }
+
+        /// Capture -> recorder packet queue
+        config.packetQueueSize = 1024;
+        if (j.contains("packet_queue_size") && j["packet_queue_size"].is_number_integer()) {
+            int p = j["packet_queue_size"].get<int>();
+            if (p >= 16)
+                config.packetQueueSize = p;
+        }
+        else
+            qWarning() << "[CFG] packet_queue_size entry not found in config. Using Default = "<<config.packetQueueSize;
+
+        config.packetQueuePolicy = PACKET_DROP_GOP;
+        if (j.contains("packet_queue_policy") && j["packet_queue_policy"].is_string()) {
+            const std::string p = j["packet_queue_policy"].get<std::string>();
+            if (p == "drop_nonkey")
+                config.packetQueuePolicy = PACKET_DROP_NONKEY;
+            else if (p == "block")
+                config.packetQueuePolicy = PACKET_BLOCK;
+            else if (p != "drop_gop")
+                qWarning() << "[CFG] Unknown packet_queue_policy" << p.c_str() << ". Using Default = drop_gop";
+        }
+
+        /// Decoder core budget (streams with decoder_threads = auto)
+        config.decoderCoreBudget = 0;
+        if (j.contains("decoder_core_budget") && j["decoder_core_budget"].is_number_integer()) {
+            int p = j["decoder_core_budget"].get<int>();
+            if (p >= 0)
+                config.decoderCoreBudget = p;
+        }
+
+        /// Stream probe cache
+        config.probeCache = 1;
+        if (j.contains("probe_cache") && j["probe_cache"].is_number_integer()) {
+            config.probeCache = j["probe_cache"].get<int>();
+        }
+        config.probeCacheFolder.clear();
+        if (j.contains("probe_cache_folder") && j["probe_cache_folder"].is_string()) {
+            config.probeCacheFolder = QString::fromStdString(j["probe_cache_folder"].get<std::string>());
+        }
+
+        /// Connection scheduler
+        config.maxConcurrentConnects = 8;
+        if (j.contains("max_concurrent_connects") && j["max_concurrent_connects"].is_number_integer()) {
+            int p = j["max_concurrent_connects"].get<int>();
+            if (p >= 0)
+                config.maxConcurrentConnects = p;
+        }
+
+        /// Pre-record memory budget (all streams)
+        config.prebufferBudgetMb = 0;
+        if (j.contains("prebuffer_budget_mb") && j["prebuffer_budget_mb"].is_number_integer()) {
+            int p = j["prebuffer_budget_mb"].get<int>();
+            if (p >= 0)
+                config.prebufferBudgetMb = p;
+        }
+
+        /// Disk-backed prebuffer (long pre-roll)
+        config.prebufferDiskFolder.clear();
+        if (j.contains("prebuffer_disk_folder") && j["prebuffer_disk_folder"].is_string()) {
+            config.prebufferDiskFolder = QString::fromStdString(j["prebuffer_disk_folder"].get<std::string>());
+        }
+        config.prebufferDiskMb = 1024;
+        if (j.contains("prebuffer_disk_mb") && j["prebuffer_disk_mb"].is_number_integer()) {
+            int p = j["prebuffer_disk_mb"].get<int>();
+            if (p > 0)
+                config.prebufferDiskMb = p;
+        }
+
+        /// MP4 layout
+        config.mp4Fragmented = 0;
+        if (j.contains("mp4_mode") && j["mp4_mode"].is_string()) {
+            const std::string m = j["mp4_mode"].get<std::string>();
+            if (m == "fragmented")
+                config.mp4Fragmented = 1;
+            else if (m != "classic")
+                qWarning() << "[CFG] Unknown mp4_mode" << m.c_str() << ". Using Default = classic";
+        }
+        config.mp4FragmentMs = 1000;
+        if (j.contains("mp4_fragment_ms") && j["mp4_fragment_ms"].is_number_integer()) {
+            int p = j["mp4_fragment_ms"].get<int>();
+            if (p >= 0)
+                config.mp4FragmentMs = p;
+        }
+
+        /// Continuous recording / segment rotation
+        config.continuousRecording = 0;
+        if (j.contains("continuous_recording") && j["continuous_recording"].is_number_integer()) {
+            config.continuousRecording = j["continuous_recording"].get<int>();
+        }
+        config.segmentMinutes = 0;
+        if (j.contains("segment_minutes") && j["segment_minutes"].is_number_integer()) {
+            int p = j["segment_minutes"].get<int>();
+            if (p >= 0)
+                config.segmentMinutes = p;
+        }
+        config.segmentMb = 0;
+        if (j.contains("segment_mb") && j["segment_mb"].is_number_integer()) {
+            int p = j["segment_mb"].get<int>();
+            if (p >= 0)
+                config.segmentMb = p;
+        }
+
+        /// Recording file I/O
+        config.recordWriteBufferKb = 1024;
+        if (j.contains("record_write_buffer_kb") && j["record_write_buffer_kb"].is_number_integer()) {
+            int p = j["record_write_buffer_kb"].get<int>();
+            if (p >= 0)
+                config.recordWriteBufferKb = p;
+        }
+
+        config.recordCachePolicy = RECORD_CACHE_NORMAL;
+        if (j.contains("record_cache_policy") && j["record_cache_policy"].is_string()) {
+            const std::string p = j["record_cache_policy"].get<std::string>();
+            if (p == "dontneed")
+                config.recordCachePolicy = RECORD_CACHE_DONTNEED;
+            else if (p == "direct")
+                config.recordCachePolicy = RECORD_CACHE_DIRECT;
+            else if (p != "normal")
+                qWarning() << "[CFG] Unknown record_cache_policy" << p.c_str() << ". Using Default = normal";
+        }
+
+        config.recordPreallocate = 1;
+        if (j.contains("record_preallocate") && j["record_preallocate"].is_number_integer()) {
+            int p = j["record_preallocate"].get<int>();
+            if (p == 0 || p == 1)
+                config.recordPreallocate = p;
+        }
+
+        /// Retention (automatic deletion of old recordings)
+        config.retentionMinFreePct = 0;
+        if (j.contains("retention_min_free_pct") && j["retention_min_free_pct"].is_number_integer()) {
+            int p = j["retention_min_free_pct"].get<int>();
+            if (p >= 0 && p < 100)
+                config.retentionMinFreePct = p;
+        }
+        config.retentionTargetFreePct = 0;
+        if (j.contains("retention_target_free_pct") && j["retention_target_free_pct"].is_number_integer()) {
+            int p = j["retention_target_free_pct"].get<int>();
+            if (p >= 0 && p <= 100)
+                config.retentionTargetFreePct = p;
+        }
+        config.retentionMaxAgeHours = 0;
+        if (j.contains("retention_max_age_hours") && j["retention_max_age_hours"].is_number_integer()) {
+            int p = j["retention_max_age_hours"].get<int>();
+            if (p >= 0)
+                config.retentionMaxAgeHours = p;
+        }
+        config.retentionMaxMb = 0;
+        if (j.contains("retention_max_mb") && j["retention_max_mb"].is_number_integer()) {
+            int p = j["retention_max_mb"].get<int>();
+            if (p >= 0)
+                config.retentionMaxMb = p;
+        }
+        config.retentionDeletesPerSec = 4;
+        if (j.contains("retention_deletes_per_sec") && j["retention_deletes_per_sec"].is_number_integer()) {
+            int p = j["retention_deletes_per_sec"].get<int>();
+            if (p > 0)
+                config.retentionDeletesPerSec = p;
+        }
+
+        /// Preview decode mode (display only)
+        config.previewDecode = PREVIEW_DECODE_ALL;
+        if (j.contains("preview_decode") && j["preview_decode"].is_string()) {
+            const std::string p = j["preview_decode"].get<std::string>();
+            if (!parsePreviewDecodeMode(p, config.previewDecode))
+                qWarning() << "[CFG] Unknown preview_decode" << p.c_str() << ". Using Default = all";
+        }
+
         // streams array
         if (!j.contains("streams") || !j["streams"].is_array()) {
             qCritical() << "[CFG] 'streams' array missing or invalid in config";
@@ -228,6 +521,44 @@ inline static bool loadConfigFile(const QString &path,
             StreamConfig sc;
             sc.id  = QString::fromStdString(s["id"].get<std::string>());
             sc.url = QString::fromStdString(s["url"].get<std::string>());
+
+            // Optional decoder threading (only used while frames are decoded)
+            if (s.contains("decoder_threads") && s["decoder_threads"].is_number_integer()) {
+                int p = s["decoder_threads"].get<int>();
+                if (p >= 0)
+                    sc.decoderThreads = p;
+            }
+            if (s.contains("decoder_thread_type") && s["decoder_thread_type"].is_string()) {
+                const std::string t = s["decoder_thread_type"].get<std::string>();
+                if (t == "slice")
+                    sc.decoderThreadType = DECODER_THREAD_SLICE;
+                else if (t == "frame")
+                    sc.decoderThreadType = DECODER_THREAD_FRAME;
+                else if (t != "auto")
+                    qWarning() << "[CFG] Unknown decoder_thread_type" << t.c_str() << "for" << sc.id << ". Using Default = auto";
+            }
+            if (s.contains("preview_url") && s["preview_url"].is_string())
+                sc.previewUrl = QString::fromStdString(s["preview_url"].get<std::string>());
+            if (s.contains("priority") && s["priority"].is_number_integer())
+                sc.priority = s["priority"].get<int>();
+            sc.previewDecode = config.previewDecode;
+            if (s.contains("preview_decode") && s["preview_decode"].is_string()) {
+                const std::string p = s["preview_decode"].get<std::string>();
+                if (!parsePreviewDecodeMode(p, sc.previewDecode))
+                    qWarning() << "[CFG] Unknown preview_decode" << p.c_str() << "for" << sc.id << ". Using global";
+            }
+            sc.maxAgeHours = config.retentionMaxAgeHours;
+            if (s.contains("max_age_hours") && s["max_age_hours"].is_number_integer()) {
+                int p = s["max_age_hours"].get<int>();
+                if (p >= 0)
+                    sc.maxAgeHours = p;
+            }
+            sc.maxMb = config.retentionMaxMb;
+            if (s.contains("max_mb") && s["max_mb"].is_number_integer()) {
+                int p = s["max_mb"].get<int>();
+                if (p >= 0)
+                    sc.maxMb = p;
+            }
             config.streamConfigs.push_back(sc);
         }
 
@@ -0,0 +1,198 @@
+#include "Capture/CaptureReactor.hpp"
+#include <algorithm>
+
+
+CaptureReactor::CaptureReactor(int ioThreads, int connectThreads)
+    : m_requestedThreads(ioThreads)
+    , m_requestedConnectThreads(connectThreads)
+{
+}
+
+CaptureReactor::~CaptureReactor()
+{
+    stop();
+    for (auto *session : m_sessions)
+        session->setWakeHandler(nullptr);
+}
+
+void CaptureReactor::addSession(RtspCaptureThread *session)
+{
+    if (m_running.load()) {
+        qWarning() << "[CAP] reactor already running, session not added:" << session->streamId();
+        return;
+    }
+    m_sessions.push_back(session);
+    session->setWakeHandler([this, session]() { wakeSession(session); });
+}
+
+void CaptureReactor::start()
+{
+    if (m_running.load() || m_sessions.empty())
+        return;
+
+    const int sessions = static_cast<int>(m_sessions.size());
+    int n = m_requestedThreads;
+    if (n <= 0)
+        n = std::max(1, QThread::idealThreadCount());
+    n = std::min(n, sessions);
+    int c = m_requestedConnectThreads > 0 ? m_requestedConnectThreads : kDefaultConnectThreads;
+    c = std::min(c, sessions);
+    m_ioThreads = n;
+
+    m_workers.clear();
+    for (int i = 0; i < c + n; ++i) {
+        auto w = std::make_unique<Worker>();
+        w->index     = i;
+        w->connector = i < c;
+        m_workers.push_back(std::move(w));
+    }
+    // Every session starts on the connect side
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        for (size_t i = 0; i < m_sessions.size(); ++i) {
+            if (!m_sessions[i]->prepareSession())
+                continue;
+            Worker *w = m_workers[i % c].get();
+            w->inbox.push_back(m_sessions[i]);
+            w->load.fetch_add(1);
+            m_owner[m_sessions[i]] = w;
+        }
+    }
+
+    qInfo() << "[CAP] reactor starting" << m_sessions.size()
+            << "sessions on" << n << "I/O threads and" << c << "connect threads";
+
+    m_running.store(true);
+    for (auto &w : m_workers) {
+        Worker *wp = w.get();
+        w->thread = std::thread([this, wp]() { workerLoop(wp); });
+    }
+}
+
+void CaptureReactor::stop()
+{
+    if (!m_running.exchange(false))
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        for (auto &w : m_workers)
+            w->cond.notify_all();
+    }
+    for (auto &w : m_workers) {
+        if (w->thread.joinable())
+            w->thread.join();
+    }
+    // Handed off while the threads were exiting
+    for (auto &w : m_workers) {
+        for (auto *session : w->inbox)
+            session->finishSession();
+        w->inbox.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_owner.clear();
+    }
+    // Sessions may outlive the reactor (requestStop() wakes them)
+    for (auto *session : m_sessions)
+        session->setWakeHandler(nullptr);
+    qInfo() << "[CAP] reactor stopped";
+}
+
+void CaptureReactor::wakeSession(RtspCaptureThread *session)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto it = m_owner.find(session);
+    if (it == m_owner.end())
+        return;
+    it->second->woken.push_back(session);
+    it->second->cond.notify_one();
+}
+
+void CaptureReactor::handOff(RtspCaptureThread *session, bool toConnector)
+{
+    Worker *best = nullptr;
+    for (auto &w : m_workers) {
+        if (w->connector == toConnector && (!best || w->load.load() < best->load.load()))
+            best = w.get();
+    }
+    best->load.fetch_add(1);
+    std::lock_guard<std::mutex> lk(m_mutex);
+    best->inbox.push_back(session);
+    m_owner[session] = best;
+    best->cond.notify_one();
+}
+
+void CaptureReactor::workerLoop(Worker *w)
+{
+    std::vector<RtspCaptureThread*> woken;
+
+    while (m_running.load()) {
+        auto now  = clock::now();
+        auto next = now + std::chrono::milliseconds(kMaxIdleWaitMs);
+
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            for (auto *session : w->inbox)
+                w->entries.push_back({session, now});
+            w->inbox.clear();
+            woken.swap(w->woken);
+        }
+        // Woken sessions (enabled/disabled, stop, connect slot free) are due
+        // again right away instead of after their idle hint
+        for (auto *session : woken) {
+            for (auto &s : w->entries) {
+                if (s.session == session)
+                    s.due = now;
+            }
+        }
+        woken.clear();
+
+        for (size_t i = 0; i < w->entries.size();) {
+            Slot &s = w->entries[i];
+            bool leave = false;
+            if (s.session->isStopRequested()) {
+                s.session->finishSession();
+                std::lock_guard<std::mutex> lk(m_mutex);
+                m_owner.erase(s.session);
+                leave = true;
+            } else if (now >= s.due) {
+                const int waitMs = s.session->step();
+                now   = clock::now();
+                s.due = now + std::chrono::milliseconds(waitMs);
+                // Streaming sessions belong to the I/O threads, the others
+                // (reconnect, open, disabled, quiet) to the connect threads
+                if (s.session->isStreaming() == w->connector) {
+                    handOff(s.session, !w->connector);
+                    leave = true;
+                }
+            }
+            if (leave) {
+                w->load.fetch_sub(1);
+                w->entries[i] = w->entries.back();
+                w->entries.pop_back();
+                continue;
+            }
+            next = std::min(next, s.due);
+            ++i;
+        }
+
+        if (next > now) {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            w->cond.wait_until(lk, next, [this, w]() {
+                return !m_running.load() || !w->inbox.empty() || !w->woken.empty();
+            });
+        }
+    }
+
+    // Not under m_mutex: finishing wakes the sessions waiting for its slot
+    std::vector<RtspCaptureThread*> inbox;
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        inbox.swap(w->inbox);
+    }
+    for (auto &s : w->entries)
+        s.session->finishSession();
+    w->entries.clear();
+    for (auto *session : inbox)
+        session->finishSession();
+}
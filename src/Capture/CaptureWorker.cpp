@@ -1,13 +1,18 @@
 #include "Capture/CaptureWorker.hpp"
 #include <chrono>
+#include <algorithm>
 
 
 RtspCaptureThread::RtspCaptureThread(const QString &streamId,
                                      const QString &url,
-                                     QObject *parent)
+                                     QObject *parent,
+                                     CaptureRole role)
     : QThread(parent)
     , m_streamId(streamId)
     , m_url(url)
+    , m_role(role)
+    , m_sessionKey(role == CAPTURE_ROLE_PREVIEW ? streamId + "@preview" : streamId)
+    , m_rng(std::random_device{}())
 {
 }
 
@@ -23,6 +28,7 @@ void RtspCaptureThread::onStreamStartRequested(const QString &streamId)
     if (streamId != m_streamId)
         return;
     m_enableStreaming.storeRelease(1);
+    wakeSession();
     qInfo() << "[CAP]" << m_streamId << "streaming ENABLED via HTTP";
 }
 
@@ -38,13 +44,99 @@ void RtspCaptureThread::onStreamStopRequested(const QString &streamId)
     // from here would race with av_read_frame() in run() (use-after-free).
     // Just request the transition via the atomic flag; run() observes it and
     // performs closeInput() + emits streamOnlineChanged(false) itself.
+    // A blocking open/read is cut short by interruptCallback().
     m_enableStreaming.storeRelease(0);
+    wakeSession();
     qInfo() << "[CAP]" << m_streamId << "streaming DISABLE requested via HTTP";
 }
 
+void RtspCaptureThread::wakeSession()
+{
+    if (m_wakeHandler) {
+        m_wakeHandler();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_wakePending = true;
+    }
+    m_sleepCond.notify_all();
+}
+
+// Polled by FFmpeg during blocking network I/O (capture thread). Non-zero
+// aborts the operation with AVERROR_EXIT, so stop/disable/shutdown do not
+// wait for the socket timeout of a dead camera.
+int RtspCaptureThread::interruptCallback(void *opaque)
+{
+    auto *self = static_cast<RtspCaptureThread*>(opaque);
+    if (self->m_abort.loadAcquire() || !self->m_enableStreaming.loadAcquire())
+        return 1;
+    return (self->m_ioDeadline != clock::time_point() && clock::now() > self->m_ioDeadline) ? 1 : 0;
+}
+
+int RtspCaptureThread::nextRetryDelayMs()
+{
+    // Exponential backoff with "equal jitter": a site-wide outage does not
+    // make every camera reconnect in the same instant
+    const int exp   = std::min(m_retryAttempt, 16);
+    const int delay = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(kRetryMinMs) << exp, kRetryMaxMs));
+    ++m_retryAttempt;
+    std::uniform_int_distribution<int> jitter(delay / 2, delay);
+    return jitter(m_rng);
+}
+
+bool RtspCaptureThread::applyCachedProbe(AVStream *vs, const StreamProbeCache::Entry &cached)
+{
+    AVCodecParameters *par = vs->codecpar;
+    if (par->codec_id != cached.codecId)
+        return false;
+    if (vs->time_base.num > 0 && cached.timeBase.num > 0 &&
+        av_cmp_q(vs->time_base, cached.timeBase) != 0)
+        return false;
+
+    // The SDP gives codec + clock rate; size and parameter sets may be missing
+    if ((par->width <= 0 || par->height <= 0) && cached.width > 0 && cached.height > 0) {
+        par->width  = cached.width;
+        par->height = cached.height;
+    }
+    if ((!par->extradata || par->extradata_size <= 0) && !cached.extradata.isEmpty()) {
+        par->extradata = static_cast<uint8_t*>(av_mallocz(cached.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+        if (!par->extradata)
+            return false;
+        memcpy(par->extradata, cached.extradata.constData(), cached.extradata.size());
+        par->extradata_size = cached.extradata.size();
+    }
+    return true;
+}
+
+void RtspCaptureThread::storeProbeCache()
+{
+    AVStream *vs = m_fmtCtx->streams[m_videoStreamIndex];
+    StreamProbeCache::Entry e;
+    e.url       = m_url;
+    e.codecId   = vs->codecpar->codec_id;
+    e.width     = m_infoWidth;
+    e.height    = m_infoHeight;
+    e.timeBase  = vs->time_base;
+    e.extradata = currentExtradata();
+    m_probeCache->store(m_sessionKey, e);
+}
+
 bool RtspCaptureThread::openInput() {
     closeInput();
 
+    m_openStartedAt = clock::now();
+    m_gotFirstPacket = false;
+    m_opens.fetchAndAddRelaxed(1);
+
+    m_fmtCtx = avformat_alloc_context();
+    if (!m_fmtCtx) {
+        qWarning() << "[CAP]" << m_streamId << "avformat_alloc_context failed";
+        return false;
+    }
+    m_fmtCtx->interrupt_callback.callback = &RtspCaptureThread::interruptCallback;
+    m_fmtCtx->interrupt_callback.opaque   = this;
+
 
     AVDictionary *opts = nullptr;
     av_dict_set(&opts, "rtsp_transport", "tcp", 0);
@@ -57,6 +149,7 @@ bool RtspCaptureThread::openInput() {
     av_dict_set(&opts, "probesize", "5000000", 0);        // bytes
     av_dict_set(&opts, "analyzeduration", "1000000", 0);  // microseconds
 
+    m_ioDeadline = clock::now() + std::chrono::milliseconds(kOpenTimeoutMs);
     int ret = avformat_open_input(&m_fmtCtx,
                                   m_url.toUtf8().constData(),
                                   nullptr,
@@ -70,14 +163,47 @@ bool RtspCaptureThread::openInput() {
         return false;
     }
 
-    ret = avformat_find_stream_info(m_fmtCtx, nullptr);
-    if (ret < 0) {
-        qWarning() << "[CAP]" << m_streamId
-                   << "avformat_find_stream_info failed:" << ret;
-        closeInput();
-        return false;
+    const clock::time_point tOpened = clock::now();
+
+    // Reuse the last known parameters when the SDP still matches them:
+    // avformat_find_stream_info() reads up to probesize/analyzeduration of
+    // media before returning, which is most of the connect time.
+    m_probeSkipped = false;
+    StreamProbeCache::Entry cached;
+    if (m_probeCache && m_probeCache->lookup(m_sessionKey, m_url, cached)) {
+        const int idx = av_find_best_stream(m_fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (idx >= 0 && applyCachedProbe(m_fmtCtx->streams[idx], cached)) {
+            m_probeSkipped = true;
+        } else {
+            qInfo() << "[CAP]" << m_streamId << "SDP does not match the cached probe -> full probe";
+            m_probeCache->invalidate(m_sessionKey);
+        }
     }
 
+    if (!m_probeSkipped) {
+        m_ioDeadline = clock::now() + std::chrono::milliseconds(kOpenTimeoutMs);
+        ret = avformat_find_stream_info(m_fmtCtx, nullptr);
+        m_ioDeadline = clock::time_point();
+        if (ret < 0) {
+            qWarning() << "[CAP]" << m_streamId
+                       << "avformat_find_stream_info failed:" << ret;
+            closeInput();
+            return false;
+        }
+        m_fullProbes.fetchAndAddRelaxed(1);
+    } else {
+        m_probesSkipped.fetchAndAddRelaxed(1);
+    }
+
+    const clock::time_point tProbed = clock::now();
+    m_lastProbeMs.storeRelease(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(tProbed - tOpened).count()));
+    m_lastOpenMs.storeRelease(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(tProbed - m_openStartedAt).count()));
+
+    // Reactor mode: set after probing so that find_stream_info does not spin.
+    // Demuxers that honour it return EAGAIN instead of blocking the I/O thread.
+    if (m_nonBlockingRead)
+        m_fmtCtx->flags |= AVFMT_FLAG_NONBLOCK;
+
     // Find video stream
     m_videoStreamIndex =
             av_find_best_stream(m_fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
@@ -91,86 +217,166 @@ bool RtspCaptureThread::openInput() {
     AVStream *vs = m_fmtCtx->streams[m_videoStreamIndex];
     AVCodecParameters *par = vs->codecpar;
 
+    // SPS/PPS from the SDP (sprop-parameter-sets) when the camera sends them
+    m_bitstream.reset(par->codec_id);
+    m_paramSetsChanged = false;
+    if (par->extradata && par->extradata_size > 0)
+        m_bitstream.setExtradata(par->extradata, static_cast<size_t>(par->extradata_size));
+
+    // Cached size vs the SDP's own SPS: trust the SPS
+    if (m_probeSkipped && m_bitstream.width() > 0 && m_bitstream.height() > 0) {
+        par->width  = m_bitstream.width();
+        par->height = m_bitstream.height();
+    }
+
+    // No decoder here: it is only opened while a frame consumer is attached
+    // (see readPacket()). The recorder just needs the codec parameters.
+    // The size may be 0 / unknown at this point for H.264 over RTSP – that's OK.
+    if (par->width > 0 && par->height > 0) {
+        m_width  = par->width;
+        m_height = par->height;
+        qDebug() << "[CAP]" << m_streamId
+                 << "codec parameters size:"
+                 << "w=" << m_width
+                 << "h=" << m_height;
+        emitStreamInfo(par->width, par->height);
+    } else if (m_bitstream.width() > 0 && m_bitstream.height() > 0) {
+        m_width  = m_bitstream.width();
+        m_height = m_bitstream.height();
+        qDebug() << "[CAP]" << m_streamId
+                 << "size from extradata SPS:"
+                 << "w=" << m_width
+                 << "h=" << m_height;
+        emitStreamInfo(m_width, m_height);
+    } else {
+        qWarning() << "[CAP]" << m_streamId
+                   << "codec parameters have no valid size yet; will parse it from the bitstream";
+        // We keep previous m_width/m_height (640x480 default) for NO SIGNAL frame only.
+        emitStreamInfo(0, 0);
+    }
+
+    // Extradata still unknown: store again once in-band parameter sets arrive
+    m_probeCacheDirty = currentExtradata().isEmpty();
+    if (m_probeCache && !m_probeSkipped)
+        storeProbeCache();
+    qInfo() << "[CAP]" << m_streamId << "opened in" << m_lastOpenMs.loadAcquire() << "ms"
+            << (m_probeSkipped ? "(cached probe)" : "(full probe)");
+    return true;
+}
+
+QByteArray RtspCaptureThread::currentExtradata() const
+{
+    AVCodecParameters *par = m_fmtCtx->streams[m_videoStreamIndex]->codecpar;
+
+    // extradata from codec parameters if present, unless the camera changed
+    // its parameter sets in-band since; then use the latest ones
+    if (par->extradata && par->extradata_size > 0 && !m_paramSetsChanged) {
+        return QByteArray(reinterpret_cast<const char*>(par->extradata),
+                          par->extradata_size);
+    }
+    const std::vector<uint8_t> ps = m_bitstream.annexBParameterSets();
+    return QByteArray(reinterpret_cast<const char*>(ps.data()),
+                      static_cast<int>(ps.size()));
+}
+
+void RtspCaptureThread::emitStreamInfo(int width, int height)
+{
+    AVStream *vs = m_fmtCtx->streams[m_videoStreamIndex];
+    AVCodecParameters *par = vs->codecpar;
+
+    // Notify recorder about stream info (time_base + codec id are known)
+    StreamInfo info;
+    info.streamId = m_streamId;
+    info.width    = width;  // may still be 0
+    info.height   = height;
+    info.timeBase = vs->time_base;
+    info.codecId  = par->codec_id;
+
+    info.extradata = currentExtradata();
+
+    m_infoWidth  = width;
+    m_infoHeight = height;
+    emit streamInfoReady(info);
+}
+
+bool RtspCaptureThread::openDecoder()
+{
+    AVCodecParameters *par = m_fmtCtx->streams[m_videoStreamIndex]->codecpar;
+
     const AVCodec *dec = avcodec_find_decoder(par->codec_id);
     if (!dec) {
         qWarning() << "[CAP]" << m_streamId
                    << "no decoder for codec_id" << par->codec_id;
-        closeInput();
         return false;
     }
 
     m_codecCtx = avcodec_alloc_context3(dec);
     if (!m_codecCtx) {
         qWarning() << "[CAP]" << m_streamId << "alloc codec ctx failed";
-        closeInput();
         return false;
     }
 
-    ret = avcodec_parameters_to_context(m_codecCtx, par);
+    int ret = avcodec_parameters_to_context(m_codecCtx, par);
     if (ret < 0) {
         qWarning() << "[CAP]" << m_streamId
                    << "avcodec_parameters_to_context failed:" << ret;
-        closeInput();
+        closeDecoder();
         return false;
     }
 
-    m_codecCtx->thread_count = 1;
-    m_codecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    // Threads: fixed per stream, or granted by the global core budget.
+    // Keyframe-only preview stays on a single low-delay thread: frame
+    // threading would hold back one keyframe (= one GOP) per extra thread.
+    int threads = 1;
+    if (m_previewDecode != PREVIEW_DECODE_KEY) {
+        if (m_decoderThreads > 0) {
+            threads = m_decoderThreads;
+        } else if (m_decoderBudget) {
+            // Rejoin with the last measured load so a reopen keeps its grant
+            m_decoderBudget->registerStream(m_sessionKey, m_decodeLoadMilli.loadAcquire() / 1000.0);
+            m_inDecoderBudget = true;
+            threads = m_decoderBudget->granted(m_sessionKey);
+        }
+    }
+
+    switch (m_decoderThreadType) {
+    case DECODER_THREAD_SLICE: m_codecCtx->thread_type = FF_THREAD_SLICE; break;
+    case DECODER_THREAD_FRAME: m_codecCtx->thread_type = FF_THREAD_FRAME; break;
+    default:                   m_codecCtx->thread_type = FF_THREAD_SLICE | FF_THREAD_FRAME; break;
+    }
+    m_codecCtx->thread_count = threads;
+    // LOW_DELAY disables frame threading in libavcodec: keep it only when
+    // frame threading is not wanted anyway
+    if (threads == 1 || !(m_codecCtx->thread_type & FF_THREAD_FRAME))
+        m_codecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+    if (m_previewDecode == PREVIEW_DECODE_KEY)
+        m_codecCtx->skip_frame = AVDISCARD_NONKEY; // in case a non-key packet slips through
+    else if (m_previewDecode == PREVIEW_DECODE_NONREF)
+        m_codecCtx->skip_frame = AVDISCARD_NONREF;
 
     ret = avcodec_open2(m_codecCtx, dec, nullptr);
     if (ret < 0) {
         qWarning() << "[CAP]" << m_streamId
                    << "avcodec_open2 failed:" << ret;
-        closeInput();
+        closeDecoder();
         return false;
     }
 
-    // These may be 0 / unknown at this point for H.264 over RTSP – that's OK.
-    m_width     = par->width;
-    m_height    = par->height;
-    m_srcPixFmt = static_cast<AVPixelFormat>(m_codecCtx->pix_fmt);
-
-    if (m_width <= 0 || m_height <= 0) {
-        qWarning() << "[CAP]" << m_streamId
-                   << "codec parameters have no valid size yet; will use first decoded frame";
-        // We keep default m_width/m_height (640x480) for NO SIGNAL frame only.
-    } else {
-        qDebug() << "[CAP]" << m_streamId
-                 << "codec parameters size:"
-                 << "w=" << m_width
-                 << "h=" << m_height;
-    }
+    m_activeDecoderThreads.storeRelease(threads);
+    m_decoderReopenPending = false;
+    m_shrinkVotes          = 0;
+    m_decodeNs             = 0;
+    m_decodedFrames        = 0;
+    m_lastDecoderReview    = clock::now();
 
     // do'nt create swsCtx here; we will create it on first decoded frame
-    if (m_swsCtx) {
-        sws_freeContext(m_swsCtx);
-        m_swsCtx = nullptr;
-    }
-
-    // Notify recorder about stream info (time_base + codec id are known)
-    StreamInfo info;
-    info.streamId = m_streamId;
-    info.width    = (m_width);  // may still be 0
-    info.height   = (m_height);
-    info.timeBase = vs->time_base;
-    info.codecId  = par->codec_id;
-
-    // copy extradata from codec parameters if present
-    if (par->extradata && par->extradata_size > 0) {
-        info.extradata = QByteArray(
-                    reinterpret_cast<const char*>(par->extradata),
-                    par->extradata_size
-                    );
-    } else {
-        info.extradata.clear();
-    }
-
-    emit streamInfoReady(info);
-
+    qInfo() << "[CAP]" << m_streamId << "decoder attached, threads =" << threads;
     return true;
 }
 
-void RtspCaptureThread::closeInput() {
+void RtspCaptureThread::closeDecoder()
+{
     if (m_swsCtx) {
         sws_freeContext(m_swsCtx);
         m_swsCtx = nullptr;
@@ -178,266 +384,501 @@ void RtspCaptureThread::closeInput() {
     if (m_codecCtx) {
         avcodec_free_context(&m_codecCtx);
         m_codecCtx = nullptr;
+        m_activeDecoderThreads.storeRelease(0);
+        qInfo() << "[CAP]" << m_streamId << "decoder detached";
+    }
+    if (m_inDecoderBudget) {
+        m_decoderBudget->unregisterStream(m_sessionKey);
+        m_inDecoderBudget = false;
     }
+}
+
+void RtspCaptureThread::closeInput() {
+    closeDecoder();
+    m_decoderFailed = false;
     if (m_fmtCtx) {
         avformat_close_input(&m_fmtCtx);
         m_fmtCtx = nullptr;
     }
     m_videoStreamIndex = -1;
+    m_readQuiet = false;
 }
 
 cv::Mat RtspCaptureThread::makeNoSignalFrame(int w, int h,QString text) {
-    cv::Mat img(h, w, CV_8UC3, cv::Scalar(40, 40, 40)); // dark gray
-    cv::putText(img,
-                text.toStdString(),
-                cv::Point(w/8, h/2),
-                cv::FONT_HERSHEY_SIMPLEX,
-                1.5,
-                cv::Scalar(0, 0, 255),
-                3);
-    return img;
+    // Shared, immutable image: drawn once per text and size for all streams
+    return StatusFrameCache::instance().get(text, w, h);
 }
 
+void RtspCaptureThread::publishFrame(const cv::Mat &frame)
+{
+    if (m_role == CAPTURE_ROLE_RECORD)
+        return; // the preview session of this stream feeds the display
+    if (m_frameMailbox)
+        m_frameMailbox->publish(frame);
+    else
+        emit frameReady(m_streamId, frame);
+}
 
-void RtspCaptureThread::run() {
-    qDebug() << "[CAP]" << m_streamId << "thread started";
+cv::Size RtspCaptureThread::frameOutputSize() const
+{
+    const quint32 target = m_frameTarget.loadAcquire();
+    if (target)
+        return cv::Size(static_cast<int>(target >> 16), static_cast<int>(target & 0xffff));
+    return cv::Size(m_width, m_height);
+}
 
-    AVPacket *pkt  = av_packet_alloc();
-    AVFrame  *frame = av_frame_alloc();
 
-    if (!pkt || !frame) {
-        qWarning() << "[CAP]" << m_streamId << "failed to allocate pkt/frame";
-        if (pkt)   av_packet_free(&pkt);
-        if (frame) av_frame_free(&frame);
+void RtspCaptureThread::setOnline(bool online)
+{
+    if (m_online == online)
         return;
+    m_online = online;
+    emit streamOnlineChanged(m_streamId, online);
+    if(mVerboseLevel>0)
+        qDebug() << "[CAP]" << m_streamId << "==> Stream status changed to" << online;
+}
+
+bool RtspCaptureThread::prepareSession()
+{
+    m_pkt   = av_packet_alloc();
+    m_frame = av_frame_alloc();
+
+    if (!m_pkt || !m_frame) {
+        qWarning() << "[CAP]" << m_streamId << "failed to allocate pkt/frame";
+        if (m_pkt)   av_packet_free(&m_pkt);
+        if (m_frame) av_frame_free(&m_frame);
+        return false;
     }
 
     // We'll reuse a "NO SIGNAL" frame; size might adjust after first successful open
-    cv::Mat noSignal = makeNoSignalFrame(m_width, m_height,"NO SIGNAL");
-    emit frameReady(m_streamId, noSignal.clone());
-
+    const cv::Size out = frameOutputSize();
+    m_noSignal = makeNoSignalFrame(out.width, out.height,"NO SIGNAL");
+    publishFrame(m_noSignal);
+    m_retryPending = false;
+    return true;
+}
 
-    using clock = std::chrono::steady_clock;
+void RtspCaptureThread::finishSession()
+{
+    QMutexLocker locker(&guard);
+    if (m_connectScheduler)
+        m_connectScheduler->cancel(m_sessionKey);
+    closeInput();
+    if (m_pkt)   av_packet_free(&m_pkt);
+    if (m_frame) av_frame_free(&m_frame);
+    setOnline(false);
+}
 
-    while (!m_abort.loadAcquire()) {
+int RtspCaptureThread::step()
+{
+    // If streaming is disabled, ensure we are offline and idle
+    if (!m_enableStreaming.loadAcquire()) {
+        // Protect this section (but not the frame emission)
+        {
+            QMutexLocker locker(&guard);
+            if (m_fmtCtx) {
+                closeInput();
+            }
+            m_retryPending = false;
+            m_retryAttempt = 0;
+            setOnline(false);
+            if (m_connectScheduler && m_waitingAdmission) {
+                m_connectScheduler->cancel(m_sessionKey);
+                m_waitingAdmission = false;
+            }
+        }
+        // Make a NOSIG image to display
+        const cv::Size out = frameOutputSize();
+        publishFrame(makeNoSignalFrame(out.width, out.height,"NO SIGNAL"));
+        return kIdlePollMs;
+    }
 
-        // If streaming is disabled, ensure we are offline and idle
-        if (!m_enableStreaming.loadAcquire()) {
-            // Protect this section (but not the sleep)
-            {
-                QMutexLocker locker(&guard);
-                if (m_fmtCtx) {
-                    closeInput();
-                }
-                if (m_online) {
-                    m_online = false;
-                    emit streamOnlineChanged(m_streamId, false);
-                    if(mVerboseLevel>0)
-                        qDebug() << "[CAP]" << m_streamId << "==> Stream status changed to false";
+    QMutexLocker locker(&guard);
+    // Ensure RTSP is open. If not, attempt every 5 seconds and show NO SIGNAL
+    if (!m_fmtCtx) {
+        if (m_retryPending) {
+            const auto now = clock::now();
+            if (now < m_retryAt) {
+                if (now - m_lastNoSignalEmit >= std::chrono::milliseconds(kNoSignalEmitMs)) {
+                    publishFrame(m_noSignal);
+                    m_lastNoSignalEmit = now;
                 }
+                const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(m_retryAt - now).count();
+                return static_cast<int>(std::min<int64_t>(left, kNoSignalEmitMs));
             }
-            // Make a NOSIG image to display
-            cv::Mat noSignal = makeNoSignalFrame(m_width, m_height,"NO SIGNAL");
-            emit frameReady(m_streamId, noSignal.clone());
-            QThread::msleep(100);
-            continue;
+            m_retryPending = false; // retry openInput() now
         }
-        else
-        {
-        QMutexLocker locker(&guard);
-        // Ensure RTSP is open. If not, attempt every 5 seconds and show NO SIGNAL
-        if (!m_fmtCtx) {
-            noSignal = makeNoSignalFrame(m_width, m_height,"ACQUIRING");
-            emit frameReady(m_streamId, noSignal.clone());
-            if (!openInput()) {
-                if (m_online) {
-                    m_online = false;
-                    emit streamOnlineChanged(m_streamId, false);
-                    if(mVerboseLevel>0)
-                        qDebug() << "[CAP]" << m_streamId << "==> Stream status changed to false";
-                }
 
-                // Build a NO SIGNAL frame with our current notion of size
-                noSignal = makeNoSignalFrame(m_width, m_height,"STREAM FAILED");
-                qWarning() << "[CAP]" << m_streamId << "will retry RTSP in 5 seconds";
-                auto startWait    = clock::now();
-                auto lastEmit     = startWait;
-                const int fpsNoSignal = 5;     // NO SIGNAL frame rate
-                const int emitMs      = 1000 / fpsNoSignal;
-
-                while (!m_abort.loadAcquire() && m_enableStreaming.loadAcquire()) {
-                    auto now          = clock::now();
-                    auto msSinceStart = std::chrono::duration_cast<std::chrono::milliseconds>(now - startWait).count();
-                    if (msSinceStart >= 5000)  // 5s
-                        break;
-
-                    auto msSinceEmit = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastEmit).count();
-                    if (msSinceEmit >= emitMs) {
-                        emit frameReady(m_streamId, noSignal.clone());
-                        lastEmit = now;
-                    }
-
-                    QThread::msleep(10);
-                }
-                continue; // retry openInput() (or handle stream disable on next iteration)
-
-            } else {
-                // Just successfully opened
-                if (!m_online) {
-                    m_online = true;
-                    emit streamOnlineChanged(m_streamId, true);
-                    if(mVerboseLevel>0)
-                        qDebug() << "[CAP]" << m_streamId << "==> Stream status changed to true";
-                }
+        const cv::Size out = frameOutputSize();
+        if (m_firstOpenAt == clock::time_point())
+            m_firstOpenAt = clock::now(); // startup time-to-first-packet includes the admission wait
+
+        // Global admission: only N sessions handshake/probe at the same time
+        if (m_connectScheduler && !m_connectScheduler->tryAcquire(m_sessionKey)) {
+            if (!m_waitingAdmission) {
+                m_waitingAdmission = true;
+                m_noSignal = makeNoSignalFrame(out.width, out.height,"ACQUIRING");
+                publishFrame(m_noSignal);
             }
+            return kAdmissionPollMs;
+        }
+        m_waitingAdmission = false;
+
+        m_noSignal = makeNoSignalFrame(out.width, out.height,"ACQUIRING");
+        publishFrame(m_noSignal);
+        const bool opened = openInput();
+        if (m_connectScheduler)
+            m_connectScheduler->release(m_sessionKey);
+        if (!opened) {
+            setOnline(false);
+
+            // Build a NO SIGNAL frame with our current notion of size
+            m_noSignal = makeNoSignalFrame(out.width, out.height,"STREAM FAILED");
+            const int delayMs = nextRetryDelayMs();
+            qWarning() << "[CAP]" << m_streamId << "will retry RTSP in" << delayMs << "ms";
+            m_retryPending     = true;
+            m_lastNoSignalEmit = clock::now();
+            m_retryAt          = m_lastNoSignalEmit + std::chrono::milliseconds(delayMs);
+            return kNoSignalEmitMs;
         }
+        // Just successfully opened
+        m_lastPacketAt = clock::now();
+        setOnline(true);
+    }
 
-        // Normal streaming loop
-        if (m_online)
-        {
-            int ret = av_read_frame(m_fmtCtx, pkt);
-            if (ret < 0) {
-                qWarning() << "[CAP]" << m_streamId
-                           << "av_read_frame error:" << ret
-                           << " -> closing and will retry";
+    // Normal streaming loop
+    if (m_online)
+        return readPacket();
+    return 0;
+}
+
+int RtspCaptureThread::readPacket()
+{
+    // Stall deadline: no packet for kStallTimeoutMs => the camera is gone
+    const clock::time_point stallAt = m_lastPacketAt + std::chrono::milliseconds(kStallTimeoutMs);
+    // Reactor I/O thread: the other sessions of the thread wait behind this
+    // read, so it only gets a short slice. A camera with nothing to send for
+    // that long is marked quiet and waits on a connect thread instead.
+    const bool sliced = m_nonBlockingRead && !m_readQuiet;
+    const clock::time_point sliceAt = clock::now() + std::chrono::milliseconds(kReadSliceMs);
+    m_ioDeadline = sliced ? std::min(stallAt, sliceAt) : stallAt;
+    int ret = av_read_frame(m_fmtCtx, m_pkt);
+    m_ioDeadline = clock::time_point();
+    if (ret < 0 && sliced && !m_abort.loadAcquire() && m_enableStreaming.loadAcquire()) {
+        const clock::time_point now = clock::now();
+        if (now >= sliceAt && now < stallAt) {
+            m_readQuiet = true;
+            m_quietReads.fetchAndAddRelaxed(1);
+            return 0;
+        }
+    }
+    if (ret == AVERROR(EAGAIN)) {
+        // Non-blocking read with nothing pending yet: let other sessions run.
+        if (clock::now() - m_lastPacketAt < std::chrono::milliseconds(kStallTimeoutMs))
+            return kNonBlockPollMs;
+        ret = AVERROR_EXIT;
+    }
+    if (ret < 0) {
+        if (m_abort.loadAcquire() || !m_enableStreaming.loadAcquire()) {
+            qDebug() << "[CAP]" << m_streamId << "read interrupted (stop requested)";
+        } else {
+            qWarning() << "[CAP]" << m_streamId
+                       << "av_read_frame error:" << ret
+                       << " -> closing and will retry";
+        }
+        closeInput();
+        setOnline(false);
+        return 0; // go back to reconnect logic
+    }
+    m_lastPacketAt = clock::now();
+    m_readQuiet    = false;
+    m_retryAttempt = 0; // stream delivers again: next outage starts at the short delay
+    if (!m_gotFirstPacket) {
+        m_gotFirstPacket = true;
+        m_lastFirstPacketMs.storeRelease(static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(m_lastPacketAt - m_openStartedAt).count()));
+        if (m_startupFirstPacketMs.loadAcquire() < 0)
+            m_startupFirstPacketMs.storeRelease(static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(m_lastPacketAt - m_firstOpenAt).count()));
+    }
+
+    if (m_pkt->stream_index != m_videoStreamIndex) {
+        av_packet_unref(m_pkt);
+        return 0;
+    }
+
+    // Build EncodedVideoPacket for recorder. The demuxed packet's reference
+    // is moved into a shared handle: recorder and decoder read the same bytes.
+    EncodedVideoPacket evp;
+    evp.streamId = m_streamId;
+    evp.pts      = m_pkt->pts;
+    evp.dts      = m_pkt->dts;
+    evp.duration = m_pkt->duration;
+    evp.key = (m_pkt->flags & AV_PKT_FLAG_KEY) != 0;
+    evp.time_base = m_fmtCtx->streams[m_videoStreamIndex]->time_base;
+
+    // Bitstream facts without a decoder: confirm IDR/IRAP keyframes and pick
+    // up in-band SPS size or parameter-set changes before the packet is queued
+    if (m_bitstream.supported()) {
+        const H26xBitstreamParser::Result bs = m_bitstream.inspect(m_pkt->data, static_cast<size_t>(m_pkt->size));
+        evp.key = evp.key || bs.keyframe;
+        if (bs.parameterSetsChanged)
+            m_paramSetsChanged = true;
+        if (bs.sizeChanged &&
+            (m_bitstream.width() != m_infoWidth || m_bitstream.height() != m_infoHeight)) {
+            m_width  = m_bitstream.width();
+            m_height = m_bitstream.height();
+            qDebug() << "[CAP]" << m_streamId
+                     << "size from bitstream:"
+                     << "w=" << m_width
+                     << "h=" << m_height;
+            emitStreamInfo(m_width, m_height);
+            m_probeCacheDirty = true;
+        } else if (bs.parameterSetsChanged) {
+            qInfo() << "[CAP]" << m_streamId << "parameter sets changed in-band";
+            emitStreamInfo(m_infoWidth, m_infoHeight);
+            m_probeCacheDirty = true;
+        } else if (bs.parameterSetAdded) {
+            m_probeCacheDirty = true; // one more SPS/PPS id, same stream
+        }
+        // Keep the probe cache in line with what the camera really sends
+        // (memory only here, the cache writes its file on its own thread)
+        if (m_probeCache && m_probeCacheDirty && bs.hasParameterSets) {
+            storeProbeCache();
+            m_probeCacheDirty = false;
+        }
+    }
+
+    evp.packet   = makePacketRef(m_pkt);
+    if (!evp.packet) {
+        qWarning() << "[CAP]" << m_streamId << "av_packet_alloc failed";
+        av_packet_unref(m_pkt);
+        return 0;
+    }
+    AVPacketRef decodePkt = evp.packet;
+    const bool  isKey     = evp.key;
+    if (m_role == CAPTURE_ROLE_PREVIEW) {
+        // substream: only decoded, the recorder gets the main stream
+    } else if (m_packetQueue) {
+        m_packetQueue->push(std::move(evp));
+    } else {
+        emit videoPacketReady(evp);
+    }
+
+    // Decoder follows frame consumers: none attached => packet-only capture.
+    // A RECORD session never decodes (its preview session does).
+    if (m_role == CAPTURE_ROLE_RECORD || m_frameConsumers.loadAcquire() <= 0) {
+        if (m_codecCtx)
+            closeDecoder();
+        return 0;
+    }
+
+    // Frame interval from the packet timestamps (for the decode load)
+    if (decodePkt->pts != AV_NOPTS_VALUE) {
+        const double ptsSec = decodePkt->pts * av_q2d(m_fmtCtx->streams[m_videoStreamIndex]->time_base);
+        const double delta  = ptsSec - m_lastPtsSec;
+        if (delta > 0.0 && delta < 1.0)
+            m_frameIntervalSec = (m_frameIntervalSec > 0.0) ? 0.9 * m_frameIntervalSec + 0.1 * delta : delta;
+        m_lastPtsSec = ptsSec;
+    }
+
+    // Keyframe-only preview: the other packets never reach the decoder
+    if (m_previewDecode == PREVIEW_DECODE_KEY && !isKey) {
+        m_packetsNotDecoded.fetchAndAddRelaxed(1);
+        return 0;
+    }
+
+    // New thread grant from the budget: switch decoders on a keyframe
+    if (m_codecCtx && m_decoderReopenPending && isKey)
+        closeDecoder();
+
+    if (!m_codecCtx) {
+        // (Re)attach on a keyframe so the decoder never starts mid-GOP
+        if (!isKey || m_decoderFailed)
+            return 0;
+        if (!openDecoder()) {
+            if (m_probeSkipped && m_probeCache) {
+                // Cached parameters may be what the decoder rejects: reconnect
+                // with a full probe
+                qWarning() << "[CAP]" << m_streamId << "decoder failed with cached probe -> full probe";
+                m_probeCache->invalidate(m_sessionKey);
                 closeInput();
-                if (m_online) {
-                    m_online = false;
-                    emit streamOnlineChanged(m_streamId, false);
-                }
-                continue; // go back to reconnect logic
+                setOnline(false);
+                return 0;
             }
+            m_decoderFailed = true; // don't retry on every packet; reset on reconnect
+            return 0;
+        }
+    }
 
-            if (pkt->stream_index != m_videoStreamIndex) {
-                av_packet_unref(pkt);
-                continue;
-            }
+    // Decode for display. Only the libavcodec calls are timed (not swscale).
+    clock::time_point t0 = clock::now();
+    ret = avcodec_send_packet(m_codecCtx, decodePkt.get());
+    m_decodeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+    if (ret < 0) {
+        qWarning() << "[CAP]" << m_streamId
+                   << "avcodec_send_packet failed:" << ret;
+        return 0;
+    }
+
+
+    while (ret >= 0 && !m_abort.loadAcquire()) {
+        t0 = clock::now();
+        ret = avcodec_receive_frame(m_codecCtx, m_frame);
+        m_decodeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            break;
+        if (ret < 0) {
+            qWarning() << "[CAP]" << m_streamId
+                       << "avcodec_receive_frame failed:" << ret;
+            break;
+        }
 
-            // Build EncodedVideoPacket for recorder
-            EncodedVideoPacket evp;
-            evp.streamId = m_streamId;   // if you include this field; if not, remove
-            evp.data = QByteArray(reinterpret_cast<const char*>(pkt->data),
-                                  pkt->size);
-            evp.pts      = pkt->pts;
-            evp.dts      = pkt->dts;
-            evp.duration = pkt->duration;
-            evp.key = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
-            evp.time_base = m_fmtCtx->streams[m_videoStreamIndex]->time_base;
-            emit videoPacketReady(evp);
-
-            // Decode for display
-            ret = avcodec_send_packet(m_codecCtx, pkt);
-            av_packet_unref(pkt);
-            if (ret < 0) {
+        ++m_decodedFrames;
+
+        // Convert + downscale in one pass straight to the display cell size
+        const quint32 target = m_frameTarget.loadAcquire();
+        const int dstW = target ? static_cast<int>(target >> 16)    : m_frame->width;
+        const int dstH = target ? static_cast<int>(target & 0xffff) : m_frame->height;
+
+        // Resolution change (in-band SPS) or new cell size: rebuild the scaler
+        if (m_swsCtx && (m_frame->width != m_width || m_frame->height != m_height ||
+                         m_frame->format != m_srcPixFmt ||
+                         dstW != m_swsDstWidth || dstH != m_swsDstHeight)) {
+            sws_freeContext(m_swsCtx);
+            m_swsCtx = nullptr;
+        }
+
+        // Initialize swscale *here* once we know real size/format
+        if (!m_swsCtx) {
+            m_width     = m_frame->width;
+            m_height    = m_frame->height;
+            m_srcPixFmt = static_cast<AVPixelFormat>(m_frame->format);
+
+            qDebug() << "[CAP]" << m_streamId
+                     << "got first frame:"
+                     << "w=" << m_width
+                     << "h=" << m_height
+                     << "fmt=" << m_srcPixFmt;
+
+            // Only re-notify the recorder if the bitstream lied about the size
+            if (m_width != m_infoWidth || m_height != m_infoHeight)
+                emitStreamInfo(m_width, m_height);
+
+            m_swsCtx = sws_getContext(
+                        m_width, m_height, m_srcPixFmt,
+                        dstW, dstH, m_dstPixFmt,
+                        SWS_BILINEAR, nullptr, nullptr, nullptr
+                        );
+            m_swsDstWidth  = dstW;
+            m_swsDstHeight = dstH;
+
+            if (!m_swsCtx) {
                 qWarning() << "[CAP]" << m_streamId
-                           << "avcodec_send_packet failed:" << ret;
-                continue;
+                           << "sws_getContext failed on first frame";
+                break;
             }
+        }
 
 
-            while (ret >= 0 && !m_abort.loadAcquire()) {
-                ret = avcodec_receive_frame(m_codecCtx, frame);
-                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-                    break;
-                if (ret < 0) {
-                    qWarning() << "[CAP]" << m_streamId
-                               << "avcodec_receive_frame failed:" << ret;
-                    break;
-                }
+        // Display has not taken the previous frame yet: skip the conversion,
+        // it would be overwritten before being shown
+        if (m_frameMailbox && !m_frameMailbox->consumed()) {
+            m_frameMailbox->noteSkipped();
+            continue;
+        }
 
-                // Initialize swscale *here* once we know real size/format
-                if (!m_swsCtx) {
-                    m_width     = frame->width;
-                    m_height    = frame->height;
-                    m_srcPixFmt = static_cast<AVPixelFormat>(frame->format);
-
-                    qDebug() << "[CAP]" << m_streamId
-                             << "got first frame:"
-                             << "w=" << m_width
-                             << "h=" << m_height
-                             << "fmt=" << m_srcPixFmt;
-
-                    // Notify recorder about stream info (time_base + codec id are known)
-                    StreamInfo info;
-                    info.streamId = m_streamId;
-                    info.width    = m_width;  // may still be 0
-                    info.height   = m_height;
-                    info.timeBase = evp.time_base;
-                    info.codecId  = m_codecCtx->codec_id;
-
-                    // Prefer extradata from codec context if available
-                    if (m_codecCtx->extradata && m_codecCtx->extradata_size > 0) {
-                        info.extradata = QByteArray(
-                                    reinterpret_cast<const char*>(m_codecCtx->extradata),
-                                    m_codecCtx->extradata_size
-                                    );
-                    } else {
-                        // Fallback: try the stream codecpar
-                        AVStream *vs = m_fmtCtx->streams[m_videoStreamIndex];
-                        AVCodecParameters *par = vs->codecpar;
-                        if (par->extradata && par->extradata_size > 0) {
-                            info.extradata = QByteArray(
-                                        reinterpret_cast<const char*>(par->extradata),
-                                        par->extradata_size
-                                        );
-                        } else {
-                            info.extradata.clear();
-                        }
-                    }
-
-                    emit streamInfoReady(info);
-
-                    m_swsCtx = sws_getContext(
-                                m_width, m_height, m_srcPixFmt,
-                                m_width, m_height, m_dstPixFmt,
-                                SWS_BILINEAR, nullptr, nullptr, nullptr
-                                );
-
-                    if (!m_swsCtx) {
-                        qWarning() << "[CAP]" << m_streamId
-                                   << "sws_getContext failed on first frame";
-                        break;
-                    }
-                }
+        // Recycled buffer: free again once the mailbox / display let go of it
+        cv::Mat bgr = m_framePool.acquire(m_swsDstWidth, m_swsDstHeight);
+        uint8_t *dstData[4]    = { bgr.data, nullptr, nullptr, nullptr };
+        int      dstLinesize[4] = { static_cast<int>(bgr.step), 0, 0, 0 };
 
+        sws_scale(m_swsCtx,
+                  m_frame->data,
+                  m_frame->linesize,
+                  0,
+                  m_height,
+                  dstData,
+                  dstLinesize);
 
-                /// Only necessary when UserInterface is needed.
-                /// Save some CPU usage
-                if (m_userInterface)
-                {
-                    cv::Mat bgr(m_height, m_width, CV_8UC3);
-                    uint8_t *dstData[4]    = { bgr.data, nullptr, nullptr, nullptr };
-                    int      dstLinesize[4] = { static_cast<int>(bgr.step), 0, 0, 0 };
+        publishFrame(bgr);
+    }
 
-                    sws_scale(m_swsCtx,
-                              frame->data,
-                              frame->linesize,
-                              0,
-                              m_height,
-                              dstData,
-                              dstLinesize);
+    if (clock::now() - m_lastDecoderReview >= std::chrono::milliseconds(kDecoderReviewMs))
+        reviewDecoderThreads();
+    return 0;
+}
 
-                    emit frameReady(m_streamId, bgr);
-                }
+void RtspCaptureThread::reviewDecoderThreads()
+{
+    const clock::time_point now = clock::now();
+    const double elapsedSec = std::chrono::duration<double>(now - m_lastDecoderReview).count();
+    m_lastDecoderReview = now;
+
+    // Reduced preview modes output only part of the frames, so their cost is
+    // measured against wall time instead of the stream frame interval
+    const bool reduced = m_previewDecode != PREVIEW_DECODE_ALL;
+    if (reduced ? (m_decodedFrames < 1 || elapsedSec <= 0.0)
+                : (m_decodedFrames < 10 || m_frameIntervalSec <= 0.0)) {
+        m_decodeNs = 0;
+        m_decodedFrames = 0;
+        return;
+    }
 
-            }
-        }
+    // Wall time spent in libavcodec per frame. With N worker threads the
+    // calls block for roughly 1/N of the work once the decoder is saturated,
+    // so wall time x threads approximates the cores the stream needs.
+    const int    active   = m_activeDecoderThreads.loadAcquire();
+    const double perFrame = (m_decodeNs / 1e9) / m_decodedFrames;
+    const double load     = reduced ? (m_decodeNs / 1e9) * active / elapsedSec
+                                    : perFrame * active / m_frameIntervalSec;
+    m_decodeUsAvg.storeRelease(static_cast<int>(perFrame * 1e6));
+    m_decodeLoadMilli.storeRelease(static_cast<int>(load * 1000.0));
+    m_decodeNs = 0;
+    m_decodedFrames = 0;
+
+    if (m_decoderThreads > 0 || !m_decoderBudget || m_previewDecode == PREVIEW_DECODE_KEY)
+        return;
 
-        }
-        QThread::usleep(500);
+    // Grow right away; shrink only after a few consistent reviews so the
+    // estimate (lower while the decoder is not saturated) does not oscillate
+    const int granted = m_decoderBudget->report(m_sessionKey, load);
+    if (granted > active) {
+        m_shrinkVotes = 0;
+        m_decoderReopenPending = true;
+    } else if (granted < active) {
+        if (++m_shrinkVotes >= kShrinkReviews)
+            m_decoderReopenPending = true;
+    } else {
+        m_shrinkVotes = 0;
+        m_decoderReopenPending = false;
     }
+    if (m_decoderReopenPending && mVerboseLevel > 0)
+        qDebug() << "[CAP]" << m_streamId << "decoder threads" << active << "->" << granted
+                 << "at next keyframe (load" << load << ")";
+}
 
-    QMutexLocker locker(&guard);
-    closeInput();
-    av_packet_free(&pkt);
-    av_frame_free(&frame);
 
-    if (m_online) {
-        m_online = false;
-        emit streamOnlineChanged(m_streamId, false);
-        if(mVerboseLevel>0)
-            qDebug() << "[CAP]" << m_streamId << "==> Stream status changed to false";
+void RtspCaptureThread::run() {
+    qDebug() << "[CAP]" << m_streamId << "thread started";
+
+    if (!prepareSession())
+        return;
+
+    while (!m_abort.loadAcquire()) {
+        const int waitMs = step();
+        if (waitMs > 0) {
+            // Interruptible: stop/start requests wake the session right away
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_sleepCond.wait_for(lock, std::chrono::milliseconds(waitMs),
+                                 [this]() { return m_wakePending; });
+            m_wakePending = false;
+        } else {
+            QThread::usleep(500);
+        }
     }
 
+    finishSession();
+
     qDebug() << "[CAP]" << m_streamId << "thread finished";
 }
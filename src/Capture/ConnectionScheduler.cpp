@@ -0,0 +1,163 @@
+#include "Capture/ConnectionScheduler.hpp"
+#include <algorithm>
+#include <climits>
+
+
+ConnectionScheduler::ConnectionScheduler(int maxConcurrent)
+    : m_maxConcurrent(maxConcurrent)
+{
+}
+
+ConnectionScheduler::StreamState *ConnectionScheduler::find(const std::string &id)
+{
+    for (auto &s : m_streams) {
+        if (s.id == id)
+            return &s;
+    }
+    return nullptr;
+}
+
+int ConnectionScheduler::waitersAbove(const StreamState &me) const
+{
+    int n = 0;
+    for (const auto &s : m_streams) {
+        if (&s == &me || !s.waiting)
+            continue;
+        if (s.priority > me.priority ||
+            (s.priority == me.priority && s.waitingSince < me.waitingSince))
+            ++n;
+    }
+    return n;
+}
+
+int ConnectionScheduler::freeSlots() const
+{
+    if (m_maxConcurrent <= 0)
+        return INT_MAX;
+    return std::max(0, m_maxConcurrent - m_active);
+}
+
+std::vector<std::function<void()>> ConnectionScheduler::admissibleWakes() const
+{
+    std::vector<const StreamState*> waiters;
+    for (const auto &s : m_streams) {
+        if (s.waiting)
+            waiters.push_back(&s);
+    }
+    std::sort(waiters.begin(), waiters.end(), [](const StreamState *a, const StreamState *b) {
+        return a->priority > b->priority ||
+               (a->priority == b->priority && a->waitingSince < b->waitingSince);
+    });
+    const size_t admit = std::min<size_t>(waiters.size(), static_cast<size_t>(freeSlots()));
+    std::vector<std::function<void()>> wakes;
+    for (size_t i = 0; i < admit; ++i) {
+        if (waiters[i]->wake)
+            wakes.push_back(waiters[i]->wake);
+    }
+    return wakes;
+}
+
+void ConnectionScheduler::registerStream(const QString &streamId, int priority, std::function<void()> wake)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::string id = streamId.toStdString();
+    if (StreamState *s = find(id)) {
+        s->priority = priority;
+        s->wake     = std::move(wake);
+        return;
+    }
+    StreamState s;
+    s.id       = id;
+    s.priority = priority;
+    s.wake     = std::move(wake);
+    m_streams.push_back(s);
+}
+
+bool ConnectionScheduler::tryAcquire(const QString &streamId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    StreamState *me = find(streamId.toStdString());
+    if (!me)
+        return true; // not scheduled
+    if (me->active)
+        return true;
+
+    const clock::time_point now = clock::now();
+    if (!me->waiting) {
+        me->waiting      = true;
+        me->waitingSince = now;
+    }
+    // The free slots go to the best ranked waiters
+    if (waitersAbove(*me) >= freeSlots())
+        return false;
+
+    me->waiting    = false;
+    me->active     = true;
+    me->lastWaitMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - me->waitingSince).count();
+    ++me->admissions;
+    ++m_active;
+    ++m_admitted;
+    m_maxWaitMs = std::max(m_maxWaitMs, me->lastWaitMs);
+    return true;
+}
+
+void ConnectionScheduler::release(const QString &streamId)
+{
+    std::vector<std::function<void()>> wakes;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        StreamState *s = find(streamId.toStdString());
+        if (!s || !s->active)
+            return;
+        s->active = false;
+        --m_active;
+        wakes = admissibleWakes();
+    }
+    for (auto &wake : wakes)
+        wake();
+}
+
+void ConnectionScheduler::cancel(const QString &streamId)
+{
+    std::vector<std::function<void()>> wakes;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        StreamState *s = find(streamId.toStdString());
+        if (!s || (!s->waiting && !s->active))
+            return;
+        // A waiter leaving moves the ones below it up, a slot freeing admits more
+        s->waiting = false;
+        if (s->active) {
+            s->active = false;
+            --m_active;
+        }
+        wakes = admissibleWakes();
+    }
+    for (auto &wake : wakes)
+        wake();
+}
+
+sl::json ConnectionScheduler::statsJson() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    sl::json j;
+    j["max_concurrent"] = m_maxConcurrent;
+    j["in_flight"]      = m_active;
+    int waiting = 0;
+    sl::json streams = sl::json::array();
+    for (const auto &s : m_streams) {
+        if (s.waiting)
+            ++waiting;
+        sl::json e;
+        e["stream_id"]    = s.id;
+        e["priority"]     = s.priority;
+        e["last_wait_ms"] = s.lastWaitMs;
+        e["admissions"]   = s.admissions;
+        streams.push_back(e);
+    }
+    j["waiting"]     = waiting;
+    j["admitted"]    = m_admitted;
+    j["max_wait_ms"] = m_maxWaitMs;
+    j["streams"]     = streams;
+    return j;
+}
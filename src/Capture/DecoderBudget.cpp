@@ -0,0 +1,119 @@
+#include "Capture/DecoderBudget.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+DecoderBudget::DecoderBudget(int cores)
+    : m_cores(cores > 0 ? cores : std::max(1, QThread::idealThreadCount()))
+{
+}
+
+void DecoderBudget::registerStream(const QString &streamId, double load)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::string id = streamId.toStdString();
+    for (const auto &e : m_entries) {
+        if (e.id == id)
+            return;
+    }
+    Entry e;
+    e.id   = id;
+    e.load = load;
+    m_entries.push_back(e);
+    rebalance();
+}
+
+void DecoderBudget::unregisterStream(const QString &streamId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::string id = streamId.toStdString();
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        if (m_entries[i].id == id) {
+            m_entries.erase(m_entries.begin() + i);
+            rebalance();
+            return;
+        }
+    }
+}
+
+int DecoderBudget::report(const QString &streamId, double load)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::string id = streamId.toStdString();
+    for (auto &e : m_entries) {
+        if (e.id == id) {
+            e.load = load;
+            rebalance();
+            return e.threads;
+        }
+    }
+    return 1;
+}
+
+int DecoderBudget::granted(const QString &streamId) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::string id = streamId.toStdString();
+    for (const auto &e : m_entries) {
+        if (e.id == id)
+            return e.threads;
+    }
+    return 1;
+}
+
+void DecoderBudget::rebalance()
+{
+    // Everyone keeps one thread (even past the budget: a stream must decode).
+    // A single thread uses at most one core, and only its measured load of
+    // it: what is left is spare for extra threads.
+    double busy = 0.0;
+    for (const auto &e : m_entries)
+        busy += std::min(e.load, 1.0);
+    int spare = static_cast<int>(std::floor(m_cores - busy));
+    std::vector<int> want(m_entries.size());
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        m_entries[i].threads = 1;
+        want[i] = std::min(kMaxThreadsPerStream,
+                           std::max(1, static_cast<int>(std::ceil(m_entries[i].load / kTargetLoadPerThread))));
+    }
+
+    // Greedy: next spare core goes to the stream with the highest load per
+    // granted thread that still wants more
+    while (spare > 0) {
+        int best = -1;
+        double bestLoad = 0.0;
+        for (size_t i = 0; i < m_entries.size(); ++i) {
+            if (m_entries[i].threads >= want[i])
+                continue;
+            const double perThread = m_entries[i].load / m_entries[i].threads;
+            if (best < 0 || perThread > bestLoad) {
+                best = static_cast<int>(i);
+                bestLoad = perThread;
+            }
+        }
+        if (best < 0)
+            break;
+        ++m_entries[best].threads;
+        --spare;
+    }
+}
+
+sl::json DecoderBudget::statsJson() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    sl::json j;
+    j["cores"] = m_cores;
+    int granted = 0;
+    sl::json streams = sl::json::array();
+    for (const auto &e : m_entries) {
+        sl::json s;
+        s["stream_id"] = e.id;
+        s["load"]      = e.load;
+        s["threads"]   = e.threads;
+        streams.push_back(s);
+        granted += e.threads;
+    }
+    j["granted"] = granted;
+    j["streams"] = streams;
+    return j;
+}
@@ -0,0 +1,139 @@
+#include "Capture/StreamProbeCache.hpp"
+
+
+StreamProbeCache::StreamProbeCache(const QString &folder)
+    : m_folder(folder)
+{
+    if (!m_folder.isEmpty()) {
+        QDir dir;
+        if (!dir.mkpath(m_folder))
+            qWarning() << "[CAP] cannot create probe cache folder" << m_folder << "(memory only)";
+        m_writer = std::thread([this]() { writerLoop(); });
+    }
+}
+
+StreamProbeCache::~StreamProbeCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_pendingCond.notify_all();
+    if (m_writer.joinable())
+        m_writer.join();
+}
+
+bool StreamProbeCache::lookup(const QString &streamId, const QString &url, Entry &out)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_entries.contains(streamId)) {
+        // Invalidated, the file is not removed yet
+        if (m_pending.contains(streamId) || m_writing == streamId)
+            return false;
+        Entry e;
+        if (m_folder.isEmpty() || !loadFromDisk(streamId, e))
+            return false;
+        m_entries.insert(streamId, e);
+    }
+    const Entry e = m_entries.value(streamId);
+    if (e.url != url || e.codecId == AV_CODEC_ID_NONE)
+        return false; // camera URL changed in the config: probe again
+    out = e;
+    return true;
+}
+
+void StreamProbeCache::store(const QString &streamId, const Entry &entry)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.insert(streamId, entry);
+    if (!m_folder.isEmpty()) {
+        m_pending.insert(streamId);
+        m_pendingCond.notify_one();
+    }
+}
+
+void StreamProbeCache::invalidate(const QString &streamId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.remove(streamId);
+    if (!m_folder.isEmpty()) {
+        m_pending.insert(streamId);
+        m_pendingCond.notify_one();
+    }
+}
+
+// The only thread touching the files, so a write and a later remove of the
+// same stream cannot land in the wrong order. Several updates of a stream
+// made meanwhile end up as one write of the latest entry.
+void StreamProbeCache::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_pendingCond.wait(lock, [this]() { return m_stopping || !m_pending.isEmpty(); });
+        if (m_pending.isEmpty())
+            return; // stopping, all written
+        const QString streamId = *m_pending.begin();
+        m_pending.erase(m_pending.begin());
+        const bool  remove = !m_entries.contains(streamId);
+        const Entry entry  = m_entries.value(streamId);
+        m_writing = streamId;
+        lock.unlock();
+        if (remove)
+            QFile::remove(filePath(streamId));
+        else
+            saveToDisk(streamId, entry);
+        lock.lock();
+        m_writing.clear();
+    }
+}
+
+QString StreamProbeCache::filePath(const QString &streamId) const
+{
+    return QDir(m_folder).filePath(streamId + ".probe.json");
+}
+
+bool StreamProbeCache::loadFromDisk(const QString &streamId, Entry &out) const
+{
+    QFile file(filePath(streamId));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const QByteArray data = file.readAll();
+    file.close();
+
+    try {
+        const sl::json j = sl::json::parse(data.constData());
+        out.url      = QString::fromStdString(j.at("url").get<std::string>());
+        out.codecId  = static_cast<AVCodecID>(j.at("codec_id").get<int>());
+        out.width    = j.at("width").get<int>();
+        out.height   = j.at("height").get<int>();
+        out.timeBase = AVRational{ j.at("time_base_num").get<int>(), j.at("time_base_den").get<int>() };
+        const std::string b64 = j.at("extradata").get<std::string>();
+        out.extradata = QByteArray::fromBase64(QByteArray(b64.c_str(), static_cast<int>(b64.size())));
+    } catch (const std::exception &e) {
+        qWarning() << "[CAP]" << streamId << "ignoring invalid probe cache file:" << e.what();
+        return false;
+    }
+    return true;
+}
+
+void StreamProbeCache::saveToDisk(const QString &streamId, const Entry &entry) const
+{
+    sl::json j;
+    j["url"]           = entry.url.toStdString();
+    j["codec_id"]      = static_cast<int>(entry.codecId);
+    j["width"]         = entry.width;
+    j["height"]        = entry.height;
+    j["time_base_num"] = entry.timeBase.num;
+    j["time_base_den"] = entry.timeBase.den;
+    const QByteArray b64 = entry.extradata.toBase64();
+    j["extradata"]     = std::string(b64.constData(), static_cast<size_t>(b64.size()));
+
+    QFile file(filePath(streamId));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "[CAP]" << streamId << "cannot write probe cache file" << file.fileName();
+        return;
+    }
+    const std::string s = j.dump(2);
+    file.write(QByteArray(s.c_str(), static_cast<int>(s.size())));
+    file.close();
+}
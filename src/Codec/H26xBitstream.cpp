@@ -0,0 +1,478 @@
+#include "Codec/H26xBitstream.hpp"
+#include <chrono>
+#include <cstring>
+
+/// Helpers
+namespace {
+
+const uint8_t kStartCode[4] = { 0, 0, 0, 1 };
+
+// Returns the first byte of the next "00 00 01" at or after p, or end.
+// memchr on the 0x01 keeps this fast on large slices.
+const uint8_t *findStartCode(const uint8_t *p, const uint8_t *end)
+{
+    const uint8_t *q = p + 2;
+    while (q < end) {
+        q = static_cast<const uint8_t*>(memchr(q, 0x01, static_cast<size_t>(end - q)));
+        if (!q)
+            return end;
+        if (q[-1] == 0 && q[-2] == 0)
+            return q - 2;
+        ++q;
+    }
+    return end;
+}
+
+bool startsWithStartCode(const uint8_t *d, size_t size)
+{
+    return size >= 3 && d[0] == 0 && d[1] == 0 &&
+           (d[2] == 1 || (size >= 4 && d[2] == 0 && d[3] == 1));
+}
+
+void skipH264ScalingList(BitReader &br, int size)
+{
+    int last = 8, next = 8;
+    for (int j = 0; j < size && !br.overrun(); ++j) {
+        if (next != 0)
+            next = (last + br.readSE() + 256) % 256;
+        last = (next == 0) ? last : next;
+    }
+}
+
+} // namespace
+
+
+const char *nalLayoutName(int layout)
+{
+    switch (layout) {
+    case NAL_LAYOUT_ANNEXB: return "annexb";
+    case NAL_LAYOUT_AVCC:   return "avcc";
+    default:                return "unknown";
+    }
+}
+
+size_t h26xUnescapeRbsp(const uint8_t *src, size_t size, uint8_t *dst)
+{
+    size_t o = 0;
+    int zeros = 0;
+    for (size_t i = 0; i < size; ++i) {
+        const uint8_t b = src[i];
+        if (zeros >= 2 && b == 0x03) {
+            zeros = 0; // emulation prevention byte
+            continue;
+        }
+        zeros = (b == 0) ? zeros + 1 : 0;
+        dst[o++] = b;
+    }
+    return o;
+}
+
+SpsInfo parseH264Sps(const uint8_t *rbsp, size_t size)
+{
+    SpsInfo sps;
+    BitReader br(rbsp, size);
+
+    sps.profile = static_cast<int>(br.readBits(8));
+    br.skipBits(8);                                  // constraint flags + reserved
+    sps.level   = static_cast<int>(br.readBits(8));
+    sps.id      = static_cast<int>(br.readUE());
+
+    bool separateColourPlane = false;
+    switch (sps.profile) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83:  case 86:  case 118: case 128: case 138:
+    case 139: case 134: case 135: {
+        sps.chromaFormat = static_cast<int>(br.readUE());
+        if (sps.chromaFormat == 3)
+            separateColourPlane = br.readBit() != 0;
+        br.readUE();                                 // bit_depth_luma_minus8
+        br.readUE();                                 // bit_depth_chroma_minus8
+        br.skipBits(1);                              // qpprime_y_zero_transform_bypass
+        if (br.readBit()) {                          // seq_scaling_matrix_present
+            const int lists = (sps.chromaFormat != 3) ? 8 : 12;
+            for (int i = 0; i < lists; ++i) {
+                if (br.readBit())
+                    skipH264ScalingList(br, i < 6 ? 16 : 64);
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    br.readUE();                                     // log2_max_frame_num_minus4
+    const uint32_t pocType = br.readUE();
+    if (pocType == 0) {
+        br.readUE();                                 // log2_max_pic_order_cnt_lsb_minus4
+    } else if (pocType == 1) {
+        br.skipBits(1);                              // delta_pic_order_always_zero
+        br.readSE();                                 // offset_for_non_ref_pic
+        br.readSE();                                 // offset_for_top_to_bottom_field
+        const uint32_t cycle = br.readUE();
+        for (uint32_t i = 0; i < cycle && !br.overrun(); ++i)
+            br.readSE();
+    }
+    br.readUE();                                     // max_num_ref_frames
+    br.skipBits(1);                                  // gaps_in_frame_num_allowed
+
+    const uint32_t widthMbs  = br.readUE() + 1;
+    const uint32_t heightMap = br.readUE() + 1;
+    const uint32_t frameMbsOnly = br.readBit();
+    if (!frameMbsOnly)
+        br.skipBits(1);                              // mb_adaptive_frame_field
+    br.skipBits(1);                                  // direct_8x8_inference
+
+    uint32_t cropL = 0, cropR = 0, cropT = 0, cropB = 0;
+    if (br.readBit()) {
+        cropL = br.readUE();
+        cropR = br.readUE();
+        cropT = br.readUE();
+        cropB = br.readUE();
+    }
+    if (br.overrun())
+        return sps;
+
+    const int chromaArrayType = separateColourPlane ? 0 : sps.chromaFormat;
+    int cropUnitX = 1;
+    int cropUnitY = 2 - static_cast<int>(frameMbsOnly);
+    if (chromaArrayType != 0) {
+        const int subW = (chromaArrayType == 1 || chromaArrayType == 2) ? 2 : 1;
+        const int subH = (chromaArrayType == 1) ? 2 : 1;
+        cropUnitX = subW;
+        cropUnitY = subH * (2 - static_cast<int>(frameMbsOnly));
+    }
+
+    sps.width  = static_cast<int>(widthMbs * 16) - cropUnitX * static_cast<int>(cropL + cropR);
+    sps.height = static_cast<int>((2 - frameMbsOnly) * heightMap * 16) - cropUnitY * static_cast<int>(cropT + cropB);
+    sps.valid  = sps.width > 0 && sps.height > 0;
+    return sps;
+}
+
+SpsInfo parseHevcSps(const uint8_t *rbsp, size_t size)
+{
+    SpsInfo sps;
+    BitReader br(rbsp, size);
+
+    br.skipBits(4);                                  // sps_video_parameter_set_id
+    const int maxSubLayersMinus1 = static_cast<int>(br.readBits(3));
+    br.skipBits(1);                                  // temporal_id_nesting
+
+    // profile_tier_level(1, maxSubLayersMinus1)
+    br.skipBits(2 + 1);                              // profile_space, tier
+    sps.profile = static_cast<int>(br.readBits(5));
+    br.skipBits(32 + 4 + 43 + 1);                    // compat flags, source flags, reserved
+    sps.level = static_cast<int>(br.readBits(8));
+    bool subProfile[8] = {false};
+    bool subLevel[8]   = {false};
+    for (int i = 0; i < maxSubLayersMinus1; ++i) {
+        subProfile[i] = br.readBit() != 0;
+        subLevel[i]   = br.readBit() != 0;
+    }
+    if (maxSubLayersMinus1 > 0) {
+        for (int i = maxSubLayersMinus1; i < 8; ++i)
+            br.skipBits(2);                          // reserved_zero_2bits
+    }
+    for (int i = 0; i < maxSubLayersMinus1; ++i) {
+        if (subProfile[i])
+            br.skipBits(88);
+        if (subLevel[i])
+            br.skipBits(8);
+    }
+
+    sps.id = static_cast<int>(br.readUE());
+    sps.chromaFormat = static_cast<int>(br.readUE());
+    bool separateColourPlane = false;
+    if (sps.chromaFormat == 3)
+        separateColourPlane = br.readBit() != 0;
+    const uint32_t width  = br.readUE();
+    const uint32_t height = br.readUE();
+
+    uint32_t confL = 0, confR = 0, confT = 0, confB = 0;
+    if (br.readBit()) {                              // conformance_window_flag
+        confL = br.readUE();
+        confR = br.readUE();
+        confT = br.readUE();
+        confB = br.readUE();
+    }
+    if (br.overrun())
+        return sps;
+
+    const int chromaArrayType = separateColourPlane ? 0 : sps.chromaFormat;
+    const int subW = (chromaArrayType == 1 || chromaArrayType == 2) ? 2 : 1;
+    const int subH = (chromaArrayType == 1) ? 2 : 1;
+
+    sps.width  = static_cast<int>(width)  - subW * static_cast<int>(confL + confR);
+    sps.height = static_cast<int>(height) - subH * static_cast<int>(confT + confB);
+    sps.valid  = sps.width > 0 && sps.height > 0;
+    return sps;
+}
+
+
+/// Class
+void H26xBitstreamParser::reset(AVCodecID codec)
+{
+    m_codec  = codec;
+    m_layout.store(NAL_LAYOUT_UNKNOWN, std::memory_order_relaxed);
+    m_nalLengthSize = 4;
+    m_sps = SpsInfo();
+    m_paramSets.clear();
+}
+
+bool H26xBitstreamParser::setExtradata(const uint8_t *data, size_t size)
+{
+    if (!supported() || !data || size < 4)
+        return false;
+
+    Result ignored;
+    const uint8_t *end = data + size;
+
+    if (startsWithStartCode(data, size)) {
+        // Annex B parameter sets (typical for RTSP sprop-parameter-sets)
+        const uint8_t *sc = findStartCode(data, end);
+        while (sc < end) {
+            const uint8_t *nal  = sc + 3;
+            const uint8_t *next = findStartCode(nal, end);
+            const uint8_t *nalEnd = next;
+            while (nalEnd > nal && nalEnd[-1] == 0)
+                --nalEnd;
+            if (nalEnd > nal)
+                handleNal(nal, static_cast<size_t>(nalEnd - nal), ignored);
+            sc = next;
+        }
+        m_layout.store(NAL_LAYOUT_ANNEXB, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (data[0] != 1)
+        return false;
+
+    const uint8_t *p = data;
+    if (m_codec == AV_CODEC_ID_H264) {
+        // avcC: version, profile, compat, level, 6b reserved + 2b lengthSizeMinusOne
+        if (size < 7)
+            return false;
+        m_nalLengthSize = (p[4] & 0x03) + 1;
+        int numSps = p[5] & 0x1f;
+        p += 6;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < numSps; ++i) {
+                if (end - p < 2)
+                    return false;
+                const size_t len = (static_cast<size_t>(p[0]) << 8) | p[1];
+                p += 2;
+                if (static_cast<size_t>(end - p) < len)
+                    return false;
+                handleNal(p, len, ignored);
+                p += len;
+            }
+            if (pass == 0) {
+                if (p >= end)
+                    break;
+                numSps = *p++;                       // numOfPictureParameterSets
+            }
+        }
+    } else {
+        // hvcC: 22 byte header, then arrays of NAL units
+        if (size < 23)
+            return false;
+        m_nalLengthSize = (p[21] & 0x03) + 1;
+        const int numArrays = p[22];
+        p += 23;
+        for (int a = 0; a < numArrays; ++a) {
+            if (end - p < 3)
+                return false;
+            const int numNalus = (p[1] << 8) | p[2];
+            p += 3;
+            for (int i = 0; i < numNalus; ++i) {
+                if (end - p < 2)
+                    return false;
+                const size_t len = (static_cast<size_t>(p[0]) << 8) | p[1];
+                p += 2;
+                if (static_cast<size_t>(end - p) < len)
+                    return false;
+                handleNal(p, len, ignored);
+                p += len;
+            }
+        }
+    }
+    m_layout.store(NAL_LAYOUT_AVCC, std::memory_order_relaxed);
+    return true;
+}
+
+H26xBitstreamParser::Result H26xBitstreamParser::inspect(const uint8_t *data, size_t size)
+{
+    if (!supported() || !data || size == 0)
+        return Result();
+
+    using clock = std::chrono::steady_clock;
+    const bool timed = (m_packets.fetch_add(1, std::memory_order_relaxed) & 15) == 0;
+    const clock::time_point t0 = timed ? clock::now() : clock::time_point();
+
+    Result r;
+    if (startsWithStartCode(data, size)) {
+        m_layout.store(NAL_LAYOUT_ANNEXB, std::memory_order_relaxed);
+        r = inspectAnnexB(data, size);
+    } else {
+        m_layout.store(NAL_LAYOUT_AVCC, std::memory_order_relaxed);
+        r = inspectLengthPrefixed(data, size);
+    }
+
+    if (r.keyframe)
+        m_keyframes.fetch_add(1, std::memory_order_relaxed);
+    if (timed) {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+        m_timedNs.fetch_add(static_cast<uint64_t>(ns), std::memory_order_relaxed);
+        m_timedPackets.fetch_add(1, std::memory_order_relaxed);
+    }
+    return r;
+}
+
+H26xBitstreamParser::Result H26xBitstreamParser::inspectAnnexB(const uint8_t *data, size_t size)
+{
+    Result r;
+    const uint8_t *end = data + size;
+    const uint8_t *sc  = findStartCode(data, end);
+    while (sc < end) {
+        const uint8_t *nal = sc + 3;
+        if (nal >= end)
+            break;
+        // VCL NALs end the scan before their (large) payload is searched
+        if (isVcl(nal[0])) {
+            handleNal(nal, static_cast<size_t>(end - nal), r);
+            break;
+        }
+        const uint8_t *next   = findStartCode(nal, end);
+        const uint8_t *nalEnd = next;
+        while (nalEnd > nal && nalEnd[-1] == 0)
+            --nalEnd; // trailing_zero_8bits / 4-byte start code
+        handleNal(nal, static_cast<size_t>(nalEnd - nal), r);
+        sc = next;
+    }
+    return r;
+}
+
+H26xBitstreamParser::Result H26xBitstreamParser::inspectLengthPrefixed(const uint8_t *data, size_t size)
+{
+    Result r;
+    const uint8_t *p   = data;
+    const uint8_t *end = data + size;
+    while (end - p >= m_nalLengthSize) {
+        size_t len = 0;
+        for (int i = 0; i < m_nalLengthSize; ++i)
+            len = (len << 8) | p[i];
+        p += m_nalLengthSize;
+        if (len == 0 || len > static_cast<size_t>(end - p))
+            break;
+        if (!handleNal(p, len, r))
+            break;
+        p += len;
+    }
+    return r;
+}
+
+bool H26xBitstreamParser::isVcl(uint8_t header) const
+{
+    if (m_codec == AV_CODEC_ID_H264) {
+        const int type = header & 0x1f;
+        return type >= 1 && type <= 5;
+    }
+    return ((header >> 1) & 0x3f) <= 31;
+}
+
+bool H26xBitstreamParser::handleNal(const uint8_t *nal, size_t size, Result &r)
+{
+    if (size < 1)
+        return true;
+
+    if (m_codec == AV_CODEC_ID_H264) {
+        const int type = nal[0] & 0x1f;
+        if (type >= 1 && type <= 5) {
+            r.keyframe = r.keyframe || type == 5;    // IDR slice
+            return false;
+        }
+        if (type == 7)
+            storeParameterSet(PS_SPS, nal, size, r);
+        else if (type == 8)
+            storeParameterSet(PS_PPS, nal, size, r);
+        return true;
+    }
+
+    // HEVC: 2 byte NAL header
+    if (size < 2)
+        return true;
+    const int type = (nal[0] >> 1) & 0x3f;
+    if (type <= 31) {
+        r.keyframe = r.keyframe || (type >= 16 && type <= 23); // BLA/IDR/CRA
+        return false;
+    }
+    if (type == 32)
+        storeParameterSet(PS_VPS, nal, size, r);
+    else if (type == 33)
+        storeParameterSet(PS_SPS, nal, size, r);
+    else if (type == 34)
+        storeParameterSet(PS_PPS, nal, size, r);
+    return true;
+}
+
+void H26xBitstreamParser::storeParameterSet(int kind, const uint8_t *nal, size_t size, Result &r)
+{
+    r.hasParameterSets = true;
+
+    const size_t header = (m_codec == AV_CODEC_ID_H264) ? 1 : 2;
+    if (size <= header)
+        return;
+
+    // Cheap check first: in-band copies usually repeat a stored set as is
+    for (const auto &ps : m_paramSets) {
+        if (ps.kind == kind && ps.nal.size() == size && memcmp(ps.nal.data(), nal, size) == 0)
+            return;
+    }
+
+    // The id is the first field, except for the H.265 SPS (after the
+    // profile/tier/level, which the SPS parser walks anyway)
+    m_rbsp.resize(size - header);
+    const size_t n = h26xUnescapeRbsp(nal + header, size - header, m_rbsp.data());
+    SpsInfo sps;
+    int id = 0;
+    if (kind == PS_SPS) {
+        sps = (m_codec == AV_CODEC_ID_H264) ? parseH264Sps(m_rbsp.data(), n)
+                                            : parseHevcSps(m_rbsp.data(), n);
+        id = sps.id;
+    } else {
+        BitReader br(m_rbsp.data(), n);
+        id = (kind == PS_VPS) ? static_cast<int>(br.readBits(4)) : static_cast<int>(br.readUE());
+    }
+
+    auto it = m_paramSets.begin();
+    while (it != m_paramSets.end() && (it->kind < kind || (it->kind == kind && it->id < id)))
+        ++it;
+    if (it != m_paramSets.end() && it->kind == kind && it->id == id) {
+        r.parameterSetsChanged = true;
+        m_psChanges.fetch_add(1, std::memory_order_relaxed);
+        it->nal.assign(nal, nal + size);
+    } else {
+        r.parameterSetAdded = true;
+        ParamSet ps;
+        ps.kind = kind;
+        ps.id   = id;
+        ps.nal.assign(nal, nal + size);
+        m_paramSets.insert(it, std::move(ps));
+    }
+
+    if (!sps.valid)
+        return;
+    if (!m_sps.valid || sps.width != m_sps.width || sps.height != m_sps.height)
+        r.sizeChanged = true;
+    m_sps = sps;
+}
+
+std::vector<uint8_t> H26xBitstreamParser::annexBParameterSets() const
+{
+    std::vector<uint8_t> out;
+    for (const auto &ps : m_paramSets) {
+        out.insert(out.end(), kStartCode, kStartCode + 4);
+        out.insert(out.end(), ps.nal.begin(), ps.nal.end());
+    }
+    return out;
+}
@@ -0,0 +1,103 @@
+#include "Recording/PrebufferBudget.hpp"
+#include <algorithm>
+
+
+PrebufferBudget::PrebufferBudget(qint64 totalBytes)
+    : m_total(totalBytes > 0 ? totalBytes : 0)
+{
+}
+
+void PrebufferBudget::registerStream(const QString &streamId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (find(streamId))
+        return;
+    Entry e;
+    e.id = streamId.toStdString();
+    m_entries.push_back(e);
+    rebalance();
+}
+
+qint64 PrebufferBudget::report(const QString &streamId, qint64 neededBytes, qint64 usedBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry *e = find(streamId);
+    if (!e)
+        return -1;
+    e->needed    = neededBytes;
+    e->used      = usedBytes;
+    e->highWater = std::max(e->highWater, usedBytes);
+
+    qint64 used = 0;
+    for (const auto &s : m_entries)
+        used += s.used;
+    m_usedHighWater = std::max(m_usedHighWater, used);
+
+    rebalance();
+    return e->allowed;
+}
+
+void PrebufferBudget::noteTrim(const QString &streamId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (Entry *e = find(streamId))
+        ++e->trims;
+}
+
+PrebufferBudget::Entry *PrebufferBudget::find(const QString &streamId)
+{
+    const std::string id = streamId.toStdString();
+    for (auto &e : m_entries) {
+        if (e.id == id)
+            return &e;
+    }
+    return nullptr;
+}
+
+void PrebufferBudget::rebalance()
+{
+    if (m_total <= 0) {
+        for (auto &e : m_entries)
+            e.allowed = -1;
+        return;
+    }
+
+    // Proportional to need; when everything fits the spare memory is split
+    // the same way, so a bitrate increase does not trim right away
+    qint64 sum = 0;
+    for (const auto &e : m_entries)
+        sum += std::max(e.needed, kMinNeededBytes);
+    for (auto &e : m_entries) {
+        const double share = static_cast<double>(std::max(e.needed, kMinNeededBytes)) / sum;
+        e.allowed = static_cast<qint64>(share * m_total);
+    }
+}
+
+sl::json PrebufferBudget::statsJson() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    sl::json j;
+    j["total_bytes"] = m_total; // 0 = no global limit
+    qint64 needed = 0, used = 0;
+    quint64 trims = 0;
+    sl::json streams = sl::json::array();
+    for (const auto &e : m_entries) {
+        sl::json s;
+        s["stream_id"]        = e.id;
+        s["needed_bytes"]     = e.needed;
+        s["allowed_bytes"]    = e.allowed; // -1 = unlimited
+        s["used_bytes"]       = e.used;
+        s["high_water_bytes"] = e.highWater;
+        s["budget_trims"]     = e.trims;
+        streams.push_back(s);
+        needed += e.needed;
+        used   += e.used;
+        trims  += e.trims;
+    }
+    j["needed_bytes"]     = needed;
+    j["used_bytes"]       = used;
+    j["high_water_bytes"] = m_usedHighWater;
+    j["budget_trims"]     = trims;
+    j["streams"]          = streams;
+    return j;
+}
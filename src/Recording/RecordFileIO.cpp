@@ -0,0 +1,407 @@
+#include "Recording/RecordFileIO.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+
+sl::json RecordIoStats::statsJson() const
+{
+    sl::json j;
+    const quint64 calls = writeCalls.loadAcquire();
+    const quint64 bytes = bytesWritten.loadAcquire();
+    j["write_calls"]     = calls;
+    j["bytes_written"]   = bytes;
+    j["bytes_per_write"] = calls ? bytes / calls : 0;
+    j["seeks"]           = seeks.loadAcquire();
+    j["seek_flushes"]    = seekFlushes.loadAcquire();
+    j["direct_writes"]   = directWrites.loadAcquire();
+    j["cache_drops"]     = cacheDrops.loadAcquire();
+    const quint64 files = filesClosed.loadAcquire();
+    j["prealloc_bytes"]  = preallocBytes.loadAcquire();
+    j["prealloc_failed"] = preallocFailed.loadAcquire();
+    j["files_closed"]    = files;
+    j["extents_last"]    = extentsLast.loadAcquire();
+    j["extents_avg"]     = files ? static_cast<double>(extentsTotal.loadAcquire()) / files : 0.0;
+    j["extents_max"]     = extentsMax.loadAcquire();
+    return j;
+}
+
+RecordFileIO::RecordFileIO(size_t bufferBytes, RecordIoStats *stats, int cachePolicy)
+    : m_stats(stats)
+    , m_policy(cachePolicy)
+{
+    // Whole blocks, at least one more than the skew can take
+    m_bufCap = std::max<size_t>(bufferBytes, kAvioBufferSize);
+    m_bufCap = (m_bufCap + kBlock - 1) / kBlock * kBlock + kBlock;
+    m_storage.resize(m_bufCap + kBlock);
+    const uintptr_t p = reinterpret_cast<uintptr_t>(m_storage.data());
+    m_buf = m_storage.data() + ((kBlock - p % kBlock) % kBlock);
+}
+
+RecordFileIO::~RecordFileIO()
+{
+    close();
+}
+
+bool RecordFileIO::open(const QString &path)
+{
+    m_file.setFileName(path);
+    // Unbuffered: every QFile::write() is one write() syscall, ours to batch
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
+        return false;
+
+#if defined(O_DIRECT)
+    // Second descriptor for the aligned blocks; the filesystem may refuse
+    // O_DIRECT (tmpfs, some FUSE/NAS mounts): then everything is "dontneed"
+    if (m_policy == RECORD_CACHE_DIRECT)
+        m_directFd = ::open(path.toUtf8().constData(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+#endif
+
+    unsigned char *avioBuf = static_cast<unsigned char*>(av_malloc(kAvioBufferSize));
+    if (!avioBuf) {
+        close();
+        return false;
+    }
+    m_avio = avio_alloc_context(avioBuf, kAvioBufferSize, 1, this,
+                                nullptr, &RecordFileIO::writeCallback, &RecordFileIO::seekCallback);
+    if (!m_avio) {
+        av_free(avioBuf);
+        close();
+        return false;
+    }
+    resetBuffer(0);
+    m_pos = m_size = 0;
+    m_relPos = m_relSize = 0;
+    m_wbPos = m_wbPrevPos = 0;
+    m_wbSize = m_wbPrevSize = 0;
+    m_allocEnd  = 0;
+    m_allocStep = 0;
+    m_failed = false;
+    return true;
+}
+
+void RecordFileIO::preallocate(int64_t bytes, int64_t stepBytes)
+{
+    if (!m_file.isOpen() || bytes <= 0)
+        return;
+    m_allocStep = std::max<int64_t>(stepBytes, kBlock);
+    reserveUpTo(bytes);
+}
+
+// Extend the reservation to cover [0, end), at least one step at a time
+void RecordFileIO::reserveUpTo(int64_t end)
+{
+    if (m_allocStep <= 0 || end <= m_allocEnd)
+        return;
+#if defined(__linux__)
+    const int64_t len = std::max(end - m_allocEnd, m_allocStep);
+    if (fallocate(m_file.handle(), FALLOC_FL_KEEP_SIZE,
+                  static_cast<off_t>(m_allocEnd), static_cast<off_t>(len)) == 0) {
+        m_allocEnd += len;
+        if (m_stats)
+            m_stats->preallocBytes.fetchAndAddRelaxed(static_cast<quint64>(len));
+        return;
+    }
+#endif
+    // Not supported here (or disk full): write without it
+    m_allocStep = 0;
+    if (m_stats)
+        m_stats->preallocFailed.fetchAndAddRelaxed(1);
+}
+
+// Give back the reserved blocks past the real end and count the extents
+void RecordFileIO::releasePreallocation()
+{
+#if defined(__linux__)
+    const int fd = m_file.handle();
+    struct stat st;
+    if (m_allocEnd > 0 && ::fstat(fd, &st) == 0 && m_allocEnd > st.st_size) {
+        // Truncating to the same size does not free the blocks past EOF on
+        // every filesystem: punch them out as well
+        if (::ftruncate(fd, st.st_size) == 0)
+            fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      st.st_size, static_cast<off_t>(m_allocEnd - st.st_size));
+    }
+    m_allocEnd  = 0;
+    m_allocStep = 0;
+
+    struct fiemap fm;
+    std::memset(&fm, 0, sizeof(fm));
+    fm.fm_length = FIEMAP_MAX_OFFSET; // fm_extent_count 0: count only
+    if (m_stats && ::ioctl(fd, FS_IOC_FIEMAP, &fm) == 0) {
+        const quint64 n = fm.fm_mapped_extents;
+        m_stats->filesClosed.fetchAndAddRelaxed(1);
+        m_stats->extentsTotal.fetchAndAddRelaxed(n);
+        m_stats->extentsLast.storeRelease(n);
+        if (n > m_stats->extentsMax.loadAcquire())
+            m_stats->extentsMax.storeRelease(n);
+    }
+#endif
+}
+
+bool RecordFileIO::close()
+{
+    if (m_avio) {
+        avio_flush(m_avio);
+        av_freep(&m_avio->buffer);
+        avio_context_free(&m_avio);
+    }
+    if (m_file.isOpen()) {
+        flushBuffer(true);
+        // Last ranges: nothing comes after them to trigger the drop. The
+        // pages still being written back stay cached until the kernel
+        // evicts them, closing never waits for the disk
+        if (m_policy != RECORD_CACHE_NORMAL) {
+            startWriteback();
+            dropCacheRange(m_wbPrevPos, m_wbPrevSize);
+            dropCacheRange(m_wbPos, m_wbSize);
+        }
+        m_relSize = m_wbSize = m_wbPrevSize = 0;
+        releasePreallocation();
+        m_file.close();
+    }
+#if !defined(_WIN32)
+    if (m_directFd >= 0) {
+        ::close(m_directFd);
+        m_directFd = -1;
+    }
+#endif
+    return !m_failed;
+}
+
+int RecordFileIO::writeCallback(void *opaque, AvioWriteBuffer buf, int size)
+{
+    return static_cast<RecordFileIO*>(opaque)->write(buf, size);
+}
+
+int64_t RecordFileIO::seekCallback(void *opaque, int64_t offset, int whence)
+{
+    return static_cast<RecordFileIO*>(opaque)->seek(offset, whence);
+}
+
+void RecordFileIO::resetBuffer(int64_t pos)
+{
+    m_bufStart = pos;
+    m_bufLen   = 0;
+    m_skew     = (m_directFd >= 0) ? static_cast<size_t>(pos % static_cast<int64_t>(kBlock)) : 0;
+}
+
+int RecordFileIO::write(const uint8_t *data, int size)
+{
+    if (size <= 0)
+        return 0;
+    const size_t n = static_cast<size_t>(size);
+
+    // Contiguous with (or inside) the buffered range and fits: memory only
+    const int64_t bufEnd = m_bufStart + static_cast<int64_t>(m_bufLen);
+    bool inRange = m_pos >= m_bufStart && m_pos <= bufEnd &&
+                   m_skew + static_cast<size_t>(m_pos - m_bufStart) + n <= m_bufCap;
+    if (!inRange && m_pos == bufEnd && m_directFd >= 0 && n < m_bufCap - kBlock) {
+        // Appending to a full buffer: write its whole blocks, keep the tail
+        if (!flushBuffer(false))
+            return AVERROR(EIO);
+        inRange = m_skew + m_bufLen + n <= m_bufCap;
+    }
+    if (!inRange) {
+        if (!flushBuffer(true))
+            return AVERROR(EIO);
+        resetBuffer(m_pos);
+        if (m_skew + n > m_bufCap) {
+            // Larger than the whole buffer: straight to the file
+            if (!writeAt(m_pos, data, n))
+                return AVERROR(EIO);
+            m_pos += size;
+            m_size = std::max(m_size, m_pos);
+            resetBuffer(m_pos);
+            return size;
+        }
+    }
+
+    const size_t at = static_cast<size_t>(m_pos - m_bufStart);
+    std::memcpy(m_buf + m_skew + at, data, n);
+    m_bufLen = std::max(m_bufLen, at + n);
+    m_pos   += size;
+    m_size   = std::max(m_size, m_pos);
+    return size;
+}
+
+int64_t RecordFileIO::seek(int64_t offset, int whence)
+{
+    if (whence & AVSEEK_SIZE)
+        return m_size;
+
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET: target = offset;          break;
+    case SEEK_CUR: target = m_pos + offset;  break;
+    case SEEK_END: target = m_size + offset; break;
+    default:       return AVERROR(EINVAL);
+    }
+    if (target < 0)
+        return AVERROR(EINVAL);
+
+    if (m_stats)
+        m_stats->seeks.fetchAndAddRelaxed(1);
+    // Outside the buffer the next write flushes it (counted there)
+    const int64_t bufEnd = m_bufStart + static_cast<int64_t>(m_bufLen);
+    if (m_bufLen > 0 && (target < m_bufStart || target > bufEnd) && m_stats)
+        m_stats->seekFlushes.fetchAndAddRelaxed(1);
+    m_pos = target;
+    return target;
+}
+
+// all = false (direct policy only): write the whole blocks and keep the
+// partial last block in the buffer, so the next flush is aligned again
+bool RecordFileIO::flushBuffer(bool all)
+{
+    if (m_bufLen == 0)
+        return !m_failed;
+
+    if (m_directFd < 0) {
+        const bool ok = writeAt(m_bufStart, m_buf, m_bufLen);
+        resetBuffer(m_bufStart + static_cast<int64_t>(m_bufLen));
+        return ok;
+    }
+
+    // Unaligned head up to the first block boundary, then whole blocks
+    const size_t head   = std::min(m_bufLen, (kBlock - m_skew) % kBlock);
+    const size_t blocks = (m_bufLen - head) / kBlock * kBlock;
+    const size_t tail   = all ? m_bufLen - head - blocks : 0;
+    bool ok = true;
+    if (head > 0)
+        ok = writeAt(m_bufStart, m_buf + m_skew, head) && ok;
+    if (blocks > 0)
+        ok = writeDirect(m_bufStart + static_cast<int64_t>(head), m_buf + m_skew + head, blocks) && ok;
+    if (tail > 0)
+        ok = writeAt(m_bufStart + static_cast<int64_t>(head + blocks), m_buf + m_skew + head + blocks, tail) && ok;
+
+    const size_t  done = head + blocks + tail;
+    const size_t  keep = m_bufLen - done;
+    const int64_t next = m_bufStart + static_cast<int64_t>(done);
+    if (keep > 0)
+        std::memmove(m_buf, m_buf + m_skew + done, keep); // next is aligned: skew 0
+    resetBuffer(next);
+    m_bufLen = keep;
+    return ok;
+}
+
+bool RecordFileIO::writeAt(int64_t pos, const uint8_t *data, size_t size)
+{
+    reserveUpTo(pos + static_cast<int64_t>(size));
+    if (m_file.pos() != pos && !m_file.seek(pos)) {
+        m_failed = true;
+        return false;
+    }
+    const int64_t start = pos;
+    const size_t  total = size;
+    while (size > 0) {
+        const qint64 w = m_file.write(reinterpret_cast<const char*>(data), static_cast<qint64>(size));
+        if (m_stats)
+            m_stats->writeCalls.fetchAndAddRelaxed(1);
+        if (w <= 0) {
+            m_failed = true;
+            return false;
+        }
+        if (m_stats)
+            m_stats->bytesWritten.fetchAndAddRelaxed(static_cast<quint64>(w));
+        data += w;
+        size -= static_cast<size_t>(w);
+    }
+    releaseCache(start, total);
+    return true;
+}
+
+bool RecordFileIO::writeDirect(int64_t pos, const uint8_t *data, size_t size)
+{
+#if !defined(_WIN32)
+    reserveUpTo(pos + static_cast<int64_t>(size));
+    while (size > 0) {
+        const ssize_t w = ::pwrite(m_directFd, data, size, static_cast<off_t>(pos));
+        if (m_stats) {
+            m_stats->writeCalls.fetchAndAddRelaxed(1);
+            m_stats->directWrites.fetchAndAddRelaxed(1);
+        }
+        if (w <= 0 || static_cast<size_t>(w) % kBlock != 0) {
+            // Partial or refused: finish through the cache
+            if (w > 0) {
+                data += w;
+                pos  += w;
+                size -= static_cast<size_t>(w);
+            }
+            return writeAt(pos, data, size);
+        }
+        if (m_stats)
+            m_stats->bytesWritten.fetchAndAddRelaxed(static_cast<quint64>(w));
+        data += w;
+        pos  += w;
+        size -= static_cast<size_t>(w);
+    }
+    return true;
+#else
+    return writeAt(pos, data, size);
+#endif
+}
+
+// Grow the written range until it is worth a writeback of its own. Patches
+// of data already in the range (mdat size, moov) are released with it
+void RecordFileIO::releaseCache(int64_t pos, size_t size)
+{
+    if (m_policy == RECORD_CACHE_NORMAL || size == 0)
+        return;
+    const int64_t end    = pos + static_cast<int64_t>(size);
+    const int64_t relEnd = m_relPos + static_cast<int64_t>(m_relSize);
+    if (m_relSize > 0 && pos >= m_relPos && pos <= relEnd) {
+        if (end > relEnd)
+            m_relSize = static_cast<size_t>(end - m_relPos);
+    } else {
+        startWriteback();
+        m_relPos  = pos;
+        m_relSize = size;
+    }
+    if (m_relSize >= kCacheReleaseBytes)
+        startWriteback();
+}
+
+// Start the writeback of the pending range without waiting for it, and
+// drop the range started two ranges ago: it has had the time of two
+// ranges to reach the disk. Never waits on the writer thread
+void RecordFileIO::startWriteback()
+{
+    if (m_relSize == 0)
+        return;
+#if defined(__linux__)
+    sync_file_range(m_file.handle(), static_cast<off_t>(m_relPos), static_cast<off_t>(m_relSize),
+                    SYNC_FILE_RANGE_WRITE);
+#endif
+    dropCacheRange(m_wbPrevPos, m_wbPrevSize);
+    m_wbPrevPos  = m_wbPos;
+    m_wbPrevSize = m_wbSize;
+    m_wbPos      = m_relPos;
+    m_wbSize     = m_relSize;
+    m_relSize    = 0;
+}
+
+// Pages still dirty or under writeback are skipped by the kernel and stay
+// cached; the next ranges' drops do not come back for them
+void RecordFileIO::dropCacheRange(int64_t pos, size_t size)
+{
+    if (size == 0)
+        return;
+#if !defined(_WIN32)
+    posix_fadvise(m_file.handle(), static_cast<off_t>(pos), static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+    if (m_stats)
+        m_stats->cacheDrops.fetchAndAddRelaxed(1);
+#else
+    Q_UNUSED(pos);
+#endif
+}
@@ -0,0 +1,124 @@
+#include "Recording/RecorderPool.hpp"
+#include "Recording/MP4Recorder.hpp"
+#include <QRunnable>
+#include <algorithm>
+
+namespace {
+
+class FileTask : public QRunnable {
+public:
+    explicit FileTask(std::function<void()> fn) : m_fn(std::move(fn)) {}
+    void run() override { m_fn(); }
+
+private:
+    std::function<void()> m_fn;
+};
+
+} // namespace
+
+void RecorderThreadStats::noteDrain(qint64 waitUs, qint64 busy, size_t n)
+{
+    drains.fetchAndAddRelaxed(1);
+    packets.fetchAndAddRelaxed(static_cast<quint64>(n));
+    busyUs.fetchAndAddRelaxed(static_cast<quint64>(std::max<qint64>(busy, 0)));
+    if (waitUs < 0)
+        return;
+    waitUsTotal.fetchAndAddRelaxed(static_cast<quint64>(waitUs));
+    qint64 max = waitUsMax.loadRelaxed();
+    while (waitUs > max && !waitUsMax.testAndSetRelaxed(max, waitUs))
+        max = waitUsMax.loadRelaxed();
+}
+
+sl::json RecorderThreadStats::statsJson() const
+{
+    sl::json j;
+    const quint64 n = drains.loadAcquire();
+    j["recorders"]   = recorders.loadAcquire();
+    j["drains"]      = n;
+    j["packets"]     = packets.loadAcquire();
+    j["busy_ms"]     = busyUs.loadAcquire() / 1000;
+    j["wait_us_avg"] = n ? waitUsTotal.loadAcquire() / n : 0;
+    j["wait_us_max"] = waitUsMax.loadAcquire();
+    return j;
+}
+
+RecorderPool::RecorderPool(int threads, int recorders)
+{
+    int n = threads;
+    if (n <= 0)
+        n = std::max(1, QThread::idealThreadCount());
+    n = std::max(1, std::min(n, recorders));
+
+    for (int i = 0; i < n; ++i) {
+        auto w = std::make_unique<Worker>();
+        w->thread = new QThread();
+        w->thread->setObjectName(QString("rec-writer-%1").arg(i));
+        m_workers.push_back(std::move(w));
+    }
+    m_fileThreads.setMaxThreadCount(kFileThreads);
+}
+
+RecorderPool::~RecorderPool()
+{
+    stop();
+    for (auto &w : m_workers)
+        delete w->thread;
+}
+
+void RecorderPool::addRecorder(Mp4RecorderWorker *recorder)
+{
+    Worker *best = m_workers.front().get();
+    for (auto &w : m_workers) {
+        if (w->stats.recorders.loadRelaxed() < best->stats.recorders.loadRelaxed())
+            best = w.get();
+    }
+    best->stats.recorders.fetchAndAddRelaxed(1);
+    recorder->setDrainStats(&best->stats);
+    recorder->setRecorderPool(this);
+    recorder->moveToThread(best->thread);
+    QObject::connect(best->thread, &QThread::finished,
+                     recorder, &QObject::deleteLater);
+}
+
+void RecorderPool::runFileTask(std::function<void()> task)
+{
+    m_fileThreads.start(new FileTask(std::move(task)));
+}
+
+void RecorderPool::start()
+{
+    if (m_running)
+        return;
+    m_running = true;
+    int recorders = 0;
+    for (auto &w : m_workers) {
+        recorders += w->stats.recorders.loadRelaxed();
+        w->thread->start();
+    }
+    qInfo() << "[REC] writer pool starting" << recorders
+            << "recorders on" << m_workers.size() << "threads";
+}
+
+void RecorderPool::stop()
+{
+    if (!m_running)
+        return;
+    m_running = false;
+    for (auto &w : m_workers) {
+        w->thread->quit();
+        w->thread->wait();
+    }
+    // The recorders wait for their own file tasks when deleted
+    m_fileThreads.waitForDone();
+    qInfo() << "[REC] writer pool stopped";
+}
+
+sl::json RecorderPool::statsJson() const
+{
+    sl::json j;
+    sl::json threads = sl::json::array();
+    for (const auto &w : m_workers)
+        threads.push_back(w->stats.statsJson());
+    j["threads"] = threads;
+    return j;
+}
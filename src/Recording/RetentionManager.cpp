@@ -0,0 +1,357 @@
+#include "Recording/RetentionManager.hpp"
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+// linux/ioprio.h is not installed everywhere
+static const int kIoprioWhoProcess = 1;
+static const int kIoprioClassBe    = 2; // best effort
+static const int kIoprioClassShift = 13;
+static const int kIoprioLowest     = 7;
+#endif
+
+
+RetentionManager::RetentionManager(const QString &folder, const Rules &rules)
+    : m_folder(folder)
+    , m_rules(rules)
+{
+    if (m_rules.minFreePct > 0 && m_rules.targetFreePct <= m_rules.minFreePct)
+        m_rules.targetFreePct = std::min(100, m_rules.minFreePct + 5);
+    if (m_rules.deletesPerSec <= 0)
+        m_rules.deletesPerSec = 1;
+}
+
+RetentionManager::~RetentionManager()
+{
+    stop();
+}
+
+void RetentionManager::addStream(const QString &streamId, int maxAgeHours, int maxMb)
+{
+    if (m_running.load()) {
+        qWarning() << "[REC] retention already running, stream not added:" << streamId;
+        return;
+    }
+    Stream s;
+    s.id        = streamId.toStdString();
+    s.prefix    = QString("rec_%1_").arg(streamId);
+    s.maxAgeSec = static_cast<qint64>(std::max(maxAgeHours, 0)) * 3600;
+    s.maxBytes  = static_cast<qint64>(std::max(maxMb, 0)) * 1024 * 1024;
+    m_streams.push_back(s);
+}
+
+bool RetentionManager::enabled() const
+{
+    if (m_rules.minFreePct > 0)
+        return true;
+    for (const auto &s : m_streams) {
+        if (s.maxAgeSec > 0 || s.maxBytes > 0)
+            return true;
+    }
+    return false;
+}
+
+void RetentionManager::start()
+{
+    if (m_running.load() || !enabled())
+        return;
+    QElapsedTimer timer;
+    timer.start();
+    scanFolder();
+
+    size_t files = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &s : m_streams)
+            files += s.files.size();
+    }
+    qInfo() << "[REC] retention indexed" << files << "files of" << m_streams.size()
+            << "streams in" << timer.elapsed() << "ms";
+
+    m_running.store(true);
+    m_thread = std::thread([this]() { threadLoop(); });
+}
+
+void RetentionManager::stop()
+{
+    if (!m_running.exchange(false))
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m_wakeMutex);
+        m_wake = true;
+    }
+    m_wakeCond.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+// The only directory listing: existing recordings, oldest first
+void RetentionManager::scanFolder()
+{
+    QDir dir(m_folder);
+    dir.setFilter(QDir::Files | QDir::NoSymLinks);
+    dir.setNameFilters(QStringList() << "rec_*.mp4");
+    dir.setSorting(QDir::Time | QDir::Reversed);
+    const QFileInfoList entries = dir.entryInfoList();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const QFileInfo &fi : entries) {
+        Stream *s = streamForFile(fi.fileName());
+        if (!s)
+            continue; // not one of ours (unknown stream, other naming)
+        File f;
+        f.path = fi.absoluteFilePath();
+        f.time = fi.lastModified().toSecsSinceEpoch();
+        f.size = fi.size();
+        addFile(*s, f);
+    }
+}
+
+// Longest matching "rec_<id>_" followed by the timestamp (ids may share a
+// prefix, e.g. "cam" and "cam_2")
+RetentionManager::Stream *RetentionManager::streamForFile(const QString &fileName)
+{
+    Stream *best = nullptr;
+    for (auto &s : m_streams) {
+        if (fileName.size() > s.prefix.size() && fileName.startsWith(s.prefix) &&
+            fileName.at(s.prefix.size()).isDigit() &&
+            (!best || s.prefix.size() > best->prefix.size()))
+            best = &s;
+    }
+    return best;
+}
+
+void RetentionManager::addFile(Stream &s, File f)
+{
+    if (f.size > 0)
+        s.bytes += f.size;
+    s.files.push_back(f);
+}
+
+void RetentionManager::onRecordingStarted(const QString &streamId, const QString &filePath)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::string id = streamId.toStdString();
+    for (auto &s : m_streams) {
+        if (s.id != id)
+            continue;
+        if (!s.current.isEmpty()) {
+            File f;
+            f.path = s.current;
+            f.time = QDateTime::currentSecsSinceEpoch();
+            addFile(s, f);
+        }
+        s.current = QFileInfo(filePath).absoluteFilePath();
+        return;
+    }
+}
+
+void RetentionManager::onRecordingStopped(const QString &streamId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::string id = streamId.toStdString();
+    for (auto &s : m_streams) {
+        if (s.id != id || s.current.isEmpty())
+            continue;
+        File f;
+        f.path = s.current;
+        f.time = QDateTime::currentSecsSinceEpoch();
+        addFile(s, f); // size read by the next pass, once the file is closed
+        s.current.clear();
+        return;
+    }
+}
+
+void RetentionManager::threadLoop()
+{
+#if defined(__linux__)
+    // This thread only: lowest CPU priority and lowest best-effort I/O
+    // priority, so unlinks (and their metadata I/O) yield to the recorders'
+    // writes. Not the idle class: it can starve deletes on a busy disk,
+    // exactly when space must be freed.
+    const int tid = static_cast<int>(::syscall(SYS_gettid));
+    ::setpriority(PRIO_PROCESS, static_cast<id_t>(tid), 19);
+    ::syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, (kIoprioClassBe << kIoprioClassShift) | kIoprioLowest);
+#endif
+    while (m_running.load()) {
+        QElapsedTimer timer;
+        timer.start();
+        runPass();
+        m_lastPassMs.store(timer.elapsed());
+        if (!waitMs(kPassIntervalMs))
+            break;
+    }
+}
+
+bool RetentionManager::runPass()
+{
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    bool deleted = false;
+
+    // Sizes of the files closed since the last pass
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &s : m_streams) {
+            for (auto it = s.files.rbegin(); it != s.files.rend() && it->size < 0; ++it) {
+                if (now - it->time < kMinFileAgeSec)
+                    continue;
+                it->size = std::max<qint64>(QFileInfo(it->path).size(), 0);
+                s.bytes += it->size;
+            }
+        }
+    }
+
+    // Per stream: age, then total size
+    for (auto &s : m_streams) {
+        for (;;) {
+            Reason reason;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (s.files.empty())
+                    break;
+                if (s.maxAgeSec > 0 && now - s.files.front().time > s.maxAgeSec)
+                    reason = REASON_AGE;
+                else if (s.maxBytes > 0 && s.bytes > s.maxBytes)
+                    reason = REASON_SIZE;
+                else
+                    break;
+            }
+            if (!deleteOldest(&s, reason))
+                break;
+            deleted = true;
+            if (!waitMs(1000 / m_rules.deletesPerSec))
+                return deleted;
+        }
+    }
+
+    // All streams: oldest first while the disk is too full
+    int free = freePct();
+    if (m_rules.minFreePct <= 0 || free < 0 || free >= m_rules.minFreePct)
+        return deleted;
+    qInfo() << "[REC] retention: free space" << free << "% below" << m_rules.minFreePct
+            << "%, deleting oldest recordings";
+    while (free >= 0 && free < m_rules.targetFreePct) {
+        // Streams whose oldest file was just closed wait for the next pass
+        const qint64 tooNew = QDateTime::currentSecsSinceEpoch() - kMinFileAgeSec;
+        Stream *oldest = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto &s : m_streams) {
+                if (s.files.empty() || s.files.front().time > tooNew)
+                    continue;
+                if (!oldest || s.files.front().time < oldest->files.front().time)
+                    oldest = &s;
+            }
+        }
+        if (!oldest || !deleteOldest(oldest, REASON_SPACE))
+            break;
+        deleted = true;
+        if (!waitMs(1000 / m_rules.deletesPerSec))
+            break;
+        free = freePct();
+    }
+    if (free >= 0 && free < m_rules.targetFreePct)
+        qWarning() << "[REC] retention: free space still" << free << "%, nothing left to delete";
+    return deleted;
+}
+
+bool RetentionManager::deleteOldest(Stream *s, Reason reason)
+{
+    File f;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (s->files.empty())
+            return false;
+        f = s->files.front();
+        if (QDateTime::currentSecsSinceEpoch() - f.time < kMinFileAgeSec)
+            return false;
+        s->files.pop_front();
+        if (f.size > 0)
+            s->bytes -= f.size;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    if (!QFile::remove(f.path) && QFile::exists(f.path)) {
+        // Dropped from the index anyway: retrying forever would stall the pass
+        m_deleteErrors.fetch_add(1);
+        qWarning() << "[REC] retention: cannot delete" << f.path;
+        return true;
+    }
+    const int64_t ms = timer.elapsed();
+    if (ms > m_maxDeleteMs.load())
+        m_maxDeleteMs.store(ms);
+
+    m_deletedFiles.fetch_add(1);
+    m_deletedBytes.fetch_add(static_cast<uint64_t>(std::max<qint64>(f.size, 0)));
+    switch (reason) {
+    case REASON_AGE:   m_deletedByAge.fetch_add(1);   break;
+    case REASON_SIZE:  m_deletedBySize.fetch_add(1);  break;
+    case REASON_SPACE: m_deletedBySpace.fetch_add(1); break;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++s->deleted;
+    }
+    return true;
+}
+
+int RetentionManager::freePct()
+{
+    QStorageInfo info(m_folder);
+    if (!info.isValid() || !info.isReady() || info.bytesTotal() <= 0) {
+        m_lastFreePct.store(-1);
+        return -1;
+    }
+    const int pct = static_cast<int>(info.bytesAvailable() * 100 / info.bytesTotal());
+    m_lastFreePct.store(pct);
+    return pct;
+}
+
+bool RetentionManager::waitMs(int ms)
+{
+    std::unique_lock<std::mutex> lk(m_wakeMutex);
+    m_wakeCond.wait_for(lk, std::chrono::milliseconds(ms), [this]() { return m_wake; });
+    return m_running.load();
+}
+
+sl::json RetentionManager::statsJson() const
+{
+    sl::json j;
+    j["enabled"]          = enabled();
+    j["min_free_pct"]     = m_rules.minFreePct;
+    j["target_free_pct"]  = m_rules.targetFreePct;
+    j["free_pct"]         = m_lastFreePct.load();
+    j["deleted_files"]    = m_deletedFiles.load();
+    j["deleted_bytes"]    = m_deletedBytes.load();
+    j["deleted_by_age"]   = m_deletedByAge.load();
+    j["deleted_by_size"]  = m_deletedBySize.load();
+    j["deleted_by_space"] = m_deletedBySpace.load();
+    j["delete_errors"]    = m_deleteErrors.load();
+    j["max_delete_ms"]    = m_maxDeleteMs.load();
+    j["last_pass_ms"]     = m_lastPassMs.load();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    sl::json streams = sl::json::array();
+    for (const auto &s : m_streams) {
+        sl::json e;
+        e["stream_id"] = s.id;
+        e["files"]     = static_cast<uint64_t>(s.files.size());
+        e["bytes"]     = s.bytes;
+        e["deleted"]   = s.deleted;
+        streams.push_back(e);
+    }
+    j["streams"] = streams;
+    return j;
+}
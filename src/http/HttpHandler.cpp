@@ -644,6 +644,43 @@ void HttpDataServer::createRoutes()
 
 
 
+    // GET /stats
+    //    Runtime counters (packet queues, ...) as assembled by the stats provider.
+    //    Optional query param: ?stream_id=stream_1 keeps only that stream's entry.
+    m_server.Get("/stats", [this](const httplib::Request& req, httplib::Response& res) {
+        json response;
+        if (!m_statsProvider) {
+            response["status"]  = "failed";
+            response["message"] = "No statistics available";
+            res.status = 503;
+            res.set_content(response.dump(), "application/json");
+            return;
+        }
+
+        response = m_statsProvider();
+        if (req.has_param("stream_id") && response.contains("streams")) {
+            const std::string sid = req.get_param_value("stream_id");
+            json filtered = json::array();
+            for (const auto &s : response["streams"]) {
+                if (s.contains("stream_id") && s["stream_id"] == sid)
+                    filtered.push_back(s);
+            }
+            if (filtered.empty()) {
+                json nf;
+                nf["status"]  = "not_found";
+                nf["message"] = "Unknown stream_id";
+                res.status = 404;
+                res.set_content(nf.dump(), "application/json");
+                return;
+            }
+            response["streams"] = filtered;
+        }
+        response["status"] = "ok";
+        res.status = 200;
+        res.set_content(response.dump(), "application/json");
+    });
+
+
     // Default 404 Error
     m_server.set_error_handler([](const httplib::Request&, httplib::Response& res) {
         res.status = 404;
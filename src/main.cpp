@@ -1,6 +1,8 @@
 #include "Capture/CaptureWorker.hpp"
+#include "Capture/CaptureReactor.hpp"
 #include "Display/DisplayManager.hpp"
 #include "Recording/MP4Recorder.hpp"
+#include "Recording/RetentionManager.hpp"
 #include "Http/HttpHandler.hpp"
 #include <QCoreApplication>
 
@@ -50,47 +52,91 @@ int main(int argc, char *argv[]) {
     QList<RtspCaptureThread*> captureThreads;
     QHash<QString, Mp4RecorderWorker*> recorders;
     QHash<QString, RtspCaptureThread*> captureById;
-    QList<QThread*> recorderThreads;
+    QHash<QString, RtspCaptureThread*> previewById;     // optional substream sessions (preview_url)
+    QHash<QString, std::shared_ptr<PacketQueue>> packetQueues;
+    QHash<QString, std::shared_ptr<FrameMailbox>> frameMailboxes;
+    auto decoderBudget = std::make_shared<DecoderBudget>(mAppConfig.decoderCoreBudget);
+    auto connectScheduler = std::make_shared<ConnectionScheduler>(mAppConfig.maxConcurrentConnects);
+    auto prebufferBudget = std::make_shared<PrebufferBudget>(
+                static_cast<qint64>(mAppConfig.prebufferBudgetMb) * 1024 * 1024);
+    std::shared_ptr<StreamProbeCache> probeCache;
+    if (mAppConfig.probeCache)
+        probeCache = std::make_shared<StreamProbeCache>(mAppConfig.probeCacheFolder);
     QStringList streamIds;
-
-    // --- Create per-stream capture + per-stream recorder thread ---
+    auto recorderPool = std::make_shared<RecorderPool>(mAppConfig.recorderThreads,
+                                                       static_cast<int>(mAppConfig.streamConfigs.size()));
+    RetentionManager::Rules retentionRules;
+    retentionRules.minFreePct    = mAppConfig.retentionMinFreePct;
+    retentionRules.targetFreePct = mAppConfig.retentionTargetFreePct;
+    retentionRules.deletesPerSec = mAppConfig.retentionDeletesPerSec;
+    auto retention = std::make_shared<RetentionManager>(mAppConfig.rec_base_folder, retentionRules);
+
+    // --- Create per-stream capture + recorder (on the writer pool) ---
     for (const auto &cfg : mAppConfig.streamConfigs) {
         const QString &url      = cfg.url;
         const QString &streamId = cfg.id;
         streamIds << streamId;
 
-        auto *cap = new RtspCaptureThread(streamId, url, &app);
-        cap->setWithUserInterface((bool)mAppConfig.displayMode);
-        cap->setVerboseLevel(mAppConfig.loglevel);
-        captureThreads << cap; /// Add in list for display
+        auto makeCapture = [&](const QString &sessionUrl, CaptureRole role) {
+            auto *c = new RtspCaptureThread(streamId, sessionUrl, &app, role);
+            c->setWithUserInterface((bool)mAppConfig.displayMode);
+            c->setVerboseLevel(mAppConfig.loglevel);
+            c->setNonBlockingRead(mAppConfig.captureEngine == CAPTURE_ENGINE_REACTOR);
+            c->setDecoderThreading(cfg.decoderThreads, cfg.decoderThreadType);
+            c->setPreviewDecodeMode(cfg.previewDecode);
+            c->setProbeCache(probeCache);
+            c->setConnectionScheduler(connectScheduler, cfg.priority);
+            if (cfg.decoderThreads == 0)
+                c->setDecoderBudget(decoderBudget);
+            captureThreads << c; /// Add in list for lifecycle (start/stop/reactor)
+            return c;
+        };
+
+        // Dual-stream: the main URL is only remuxed for recording, the
+        // low-res substream is the one decoded for the display
+        const bool dualStream = !cfg.previewUrl.isEmpty();
+        auto *cap = makeCapture(url, dualStream ? CAPTURE_ROLE_RECORD : CAPTURE_ROLE_FULL);
         captureById.insert(streamId, cap); /// Add in Hash for Http Connection
+        if (dualStream)
+            previewById.insert(streamId, makeCapture(cfg.previewUrl, CAPTURE_ROLE_PREVIEW));
 
-        // Recorder worker + recorder thread
-        QThread *recThread = new QThread(&app);
+        // Recorder worker, run by one of the pool's writer threads
         Mp4RecorderWorker *recWorker = new Mp4RecorderWorker(streamId);
         recWorker->setFolderBase(mAppConfig.rec_base_folder);
         recWorker->setPreBufferingTime(mAppConfig.prebufferingTime);
         recWorker->setPosteBufferingTime(mAppConfig.postbufferingTime);
+        recWorker->setWriteBufferSize(mAppConfig.recordWriteBufferKb);
+        recWorker->setRecordCachePolicy(mAppConfig.recordCachePolicy);
+        recWorker->setPreallocation(mAppConfig.recordPreallocate == 1);
+        recWorker->setFragmentedMp4(mAppConfig.mp4Fragmented == 1, mAppConfig.mp4FragmentMs);
+        recWorker->setSegmentation(mAppConfig.segmentMinutes * 60, mAppConfig.segmentMb,
+                                   mAppConfig.continuousRecording == 1);
         recWorker->setVerboseLevel(mAppConfig.loglevel);
-        recWorker->moveToThread(recThread);
-
-
-        QObject::connect(recThread, &QThread::finished,
-                         recWorker, &QObject::deleteLater);
-
-        // Connect capture -> recorder (queued)
-        QObject::connect(cap, &RtspCaptureThread::videoPacketReady,
-                         recWorker, &Mp4RecorderWorker::onPacket,
-                         Qt::QueuedConnection);
+        if (!mAppConfig.prebufferDiskFolder.isEmpty())
+            recWorker->setPrebufferDisk(mAppConfig.prebufferDiskFolder, mAppConfig.prebufferDiskMb);
+        else
+            recWorker->setPrebufferBudget(prebufferBudget);
+        recorderPool->addRecorder(recWorker);
+
+        // Connect capture -> recorder: packets through a bounded SPSC queue,
+        // stream info (rare) through a queued signal
+        auto queue = std::make_shared<PacketQueue>(mAppConfig.packetQueueSize,
+                                                   mAppConfig.packetQueuePolicy);
+        // A reactor I/O thread serves other cameras: never wait for one recorder
+        queue->setProducerCanBlock(mAppConfig.captureEngine != CAPTURE_ENGINE_REACTOR);
+        cap->setPacketQueue(queue);
+        recWorker->setPacketQueue(queue);
+        packetQueues.insert(streamId, queue);
         QObject::connect(cap, &RtspCaptureThread::streamInfoReady,
                          recWorker, &Mp4RecorderWorker::onStreamInfo,
                          Qt::QueuedConnection);
 
         recorders.insert(streamId, recWorker);
-        recorderThreads << recThread;
-
-        recThread->start();
+        retention->addStream(streamId, cfg.maxAgeHours, cfg.maxMb);
     }
+    // Index the existing recordings before any new file is created
+    retention->start();
+    recorderPool->start();
 
     // Display manager
     DisplayManager* display=nullptr;
@@ -98,10 +144,17 @@ int main(int argc, char *argv[]) {
     {
         display = new DisplayManager(&recorders, streamIds);
         display->setVerboseLevel(mAppConfig.loglevel);
-        for (auto *cap : captureThreads) {
-            QObject::connect(cap, &RtspCaptureThread::frameReady,
-                             display, &DisplayManager::onFrame,
-                             Qt::QueuedConnection);
+        for (const auto &streamId : streamIds) {
+            RtspCaptureThread *cap = previewById.value(streamId, captureById.value(streamId));
+            const cv::Size cell = DisplayManager::cellSize();
+            cap->setFrameTargetSize(cell.width, cell.height);
+
+            // Capture -> display: latest-wins slot pulled by the display timer
+            // (no queued event per decoded frame)
+            auto mailbox = std::make_shared<FrameMailbox>();
+            cap->setFrameMailbox(mailbox);
+            display->setFrameMailbox(cap->streamId(), mailbox);
+            frameMailboxes.insert(cap->streamId(), mailbox);
         }
     }
 
@@ -112,6 +165,35 @@ int main(int argc, char *argv[]) {
     HttpDataServer httpServer;
     httpServer.setVerboseLevel(mAppConfig.loglevel);
     httpServer.setFolderBase(mAppConfig.rec_base_folder);
+    // GET /stats: only thread-safe counters, objects kept alive by the lambda
+    httpServer.setStatsProvider([streamIds, packetQueues, captureById, previewById, recorders, frameMailboxes, decoderBudget, connectScheduler, prebufferBudget, recorderPool, retention]() {
+        sl::json streams = sl::json::array();
+        for (const auto &id : streamIds) {
+            sl::json s;
+            s["stream_id"] = id.toStdString();
+            s["packet_queue"] = packetQueues.value(id)->statsJson();
+            s["bitstream"] = captureById.value(id)->bitstreamStatsJson();
+            if (frameMailboxes.contains(id))
+                s["frame_mailbox"] = frameMailboxes.value(id)->statsJson();
+            RtspCaptureThread *frameSource = previewById.value(id, captureById.value(id));
+            s["frame_pool"] = frameSource->framePoolStatsJson();
+            s["decoder"] = frameSource->decoderStatsJson();
+            s["connect"] = captureById.value(id)->connectStatsJson();
+            if (previewById.contains(id))
+                s["preview_connect"] = previewById.value(id)->connectStatsJson();
+            s["recorder"] = recorders.value(id)->statsJson();
+            streams.push_back(s);
+        }
+        sl::json j;
+        j["streams"] = streams;
+        j["status_frames"] = StatusFrameCache::instance().statsJson();
+        j["decoder_budget"] = decoderBudget->statsJson();
+        j["connect_scheduler"] = connectScheduler->statsJson();
+        j["prebuffer_budget"] = prebufferBudget->statsJson();
+        j["recorder_pool"] = recorderPool->statsJson();
+        j["retention"] = retention->statsJson();
+        return j;
+    });
     // Register all known streams so /record/status always lists them
     for (const auto &streamId : streamIds) {
         QMetaObject::invokeMethod(&httpServer,
@@ -120,8 +202,9 @@ int main(int argc, char *argv[]) {
                                   Q_ARG(QString, streamId));
     }
 
-    // Capture -> HTTP server: streaming state
-    for (auto *cap : captureThreads) {
+    // Capture -> HTTP server: streaming state (main sessions only, the
+    // preview substream does not change what is reported as online)
+    for (auto *cap : captureById) {
         QObject::connect(cap, &RtspCaptureThread::streamOnlineChanged,
              &httpServer, &HttpDataServer::onStreamOnlineChanged,
             Qt::QueuedConnection);
@@ -157,48 +240,76 @@ int main(int argc, char *argv[]) {
         QObject::connect(recWorker, &Mp4RecorderWorker::recordingFailed,
                          &httpServer, &HttpDataServer::onRecordingFailed,
                          Qt::QueuedConnection);
+
+        // Recorder -> retention index (thread-safe, called on the recorder's thread)
+        QObject::connect(recWorker, &Mp4RecorderWorker::recordingStarted,
+                         [retention](const QString &id, const QString &path){
+                             retention->onRecordingStarted(id, path);
+                         });
+        QObject::connect(recWorker, &Mp4RecorderWorker::recordingStopped,
+                         [retention](const QString &id){
+                             retention->onRecordingStopped(id);
+                         });
     }
 
     // HTTP -> Capture threads: stream start/stop
-    for (const auto &streamId : streamIds) {
-        RtspCaptureThread *cap = captureById.value(streamId, nullptr);
-        if (!cap) continue;
+    // (a preview session shares the stream id, so it follows the same requests)
+    for (auto *cap : captureThreads) {
         QObject::connect(&httpServer, &HttpDataServer::startStreamRequested,
                          cap, &RtspCaptureThread::onStreamStartRequested, Qt::QueuedConnection);
         QObject::connect(&httpServer, &HttpDataServer::stopStreamRequested,
                          cap, &RtspCaptureThread::onStreamStopRequested, Qt::QueuedConnection);
 
         if (mAppConfig.autostart==1)
-           cap->onStreamStartRequested(streamId);
+           cap->onStreamStartRequested(cap->streamId());
+    }
+
+    // Reactor mode: streaming sessions share a small pool of I/O threads,
+    // opens run on as many connect threads as connect slots
+    CaptureReactor *reactor = nullptr;
+    if (mAppConfig.captureEngine == CAPTURE_ENGINE_REACTOR) {
+        reactor = new CaptureReactor(mAppConfig.captureIoThreads, mAppConfig.maxConcurrentConnects);
+        for (auto *cap : captureThreads)
+            reactor->addSession(cap); // start/stop requests wake it through wakeSession()
     }
 
     // Start HTTP server
     httpServer.start("0.0.0.0", mAppConfig.httpPort);
 
 
-    // Start all capture threads
-    for (auto *cap : captureThreads) {
-        cap->start();
+    // Start all capture threads (or the reactor pool)
+    if (reactor) {
+        reactor->start();
+    } else {
+        for (auto *cap : captureThreads) {
+            cap->start();
+        }
     }
 
     int ret = app.exec();
 
+    // Stop serving HTTP before tearing down what the handlers look at
+    httpServer.stop();
+
     // Clean up capture threads.
     // NOTE: run() loops on m_abort (set by requestStop()), NOT on Qt's
     // interruption flag; requestInterruption() would leave the loop running
     // and wait() would block forever.
-    for (auto *cap : captureThreads) {
+    for (auto *cap : captureThreads)
         cap->requestStop();
+    if (reactor) {
+        reactor->stop(); // also detaches the sessions' wake handlers
+        delete reactor;
+    }
+    for (auto *cap : captureThreads) {
         cap->wait();
         delete cap;
     }
 
-    // Stop recorder threads
-    for (auto *t : recorderThreads) {
-        t->quit();
-        t->wait();
-        delete t;
-    }
+    retention->stop();
+
+    // Stop the recorder writer threads (recorders are deleted with them)
+    recorderPool->stop();
 
     if (display)
         delete display;
@@ -0,0 +1,107 @@
+// H26xBitstreamParser::inspect() cost per packet (ns), the price paid on the
+// capture read path for every demuxed packet. Not a ctest test: run it by
+// hand on the target machine (built with -DBUILD_TESTS=ON).
+#include "Codec/H26xBitstream.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+// 320x240 baseline SPS, PPS and a slice header; slice data is filler
+const std::vector<uint8_t> kSps = { 0x67, 0x42, 0xc0, 0x0d, 0xd9, 0x01, 0x41, 0xfb, 0x01, 0x10, 0x00, 0x00,
+                                    0x03, 0x00, 0x10, 0x00, 0x00, 0x03, 0x03, 0xc0, 0xf1, 0x42, 0xa4, 0x80 };
+const std::vector<uint8_t> kPps = { 0x68, 0xce, 0x3c, 0x80 };
+const std::vector<uint8_t> kAud = { 0x09, 0xf0 };
+const std::vector<uint8_t> kSei = { 0x06, 0x05, 0x04, 0x11, 0x22, 0x33, 0x44, 0x80 };
+
+std::vector<uint8_t> slice(uint8_t header, size_t bytes)
+{
+    std::vector<uint8_t> nal(bytes, 0xa5);
+    nal[0] = header;
+    nal[1] = 0x88;
+    return nal;
+}
+
+std::vector<uint8_t> hevcSlice(size_t bytes)
+{
+    std::vector<uint8_t> nal(bytes, 0xa5);
+    nal[0] = 0x02; // TRAIL_R
+    nal[1] = 0x01;
+    return nal;
+}
+
+void appendAnnexB(std::vector<uint8_t> &au, const std::vector<uint8_t> &nal)
+{
+    au.insert(au.end(), { 0, 0, 0, 1 });
+    au.insert(au.end(), nal.begin(), nal.end());
+}
+
+void appendAvcc(std::vector<uint8_t> &au, const std::vector<uint8_t> &nal)
+{
+    const uint32_t n = static_cast<uint32_t>(nal.size());
+    au.insert(au.end(), { uint8_t(n >> 24), uint8_t(n >> 16), uint8_t(n >> 8), uint8_t(n) });
+    au.insert(au.end(), nal.begin(), nal.end());
+}
+
+std::vector<uint8_t> avcC()
+{
+    std::vector<uint8_t> r = { 1, kSps[1], kSps[2], kSps[3], 0xff, 0xe1 };
+    r.insert(r.end(), { uint8_t(kSps.size() >> 8), uint8_t(kSps.size()) });
+    r.insert(r.end(), kSps.begin(), kSps.end());
+    r.insert(r.end(), { 1, uint8_t(kPps.size() >> 8), uint8_t(kPps.size()) });
+    r.insert(r.end(), kPps.begin(), kPps.end());
+    return r;
+}
+
+void run(const char *name, AVCodecID codec, const std::vector<uint8_t> &extradata,
+         const std::vector<uint8_t> &au, int iterations)
+{
+    H26xBitstreamParser parser(codec);
+    if (!extradata.empty())
+        parser.setExtradata(extradata.data(), extradata.size());
+    unsigned keys = 0;
+    for (int i = 0; i < 1000; ++i) // warm-up, parameter sets stored
+        keys += parser.inspect(au.data(), au.size()).keyframe;
+
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        keys += parser.inspect(au.data(), au.size()).keyframe;
+    const auto t1 = std::chrono::steady_clock::now();
+
+    const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / iterations;
+    std::printf("%-40s %8zu B %9.1f ns/packet  (keys %u)\n", name, au.size(), ns, keys);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const int iterations = argc > 1 ? std::atoi(argv[1]) : 2000000;
+
+    std::vector<uint8_t> pSmall, pLarge, pSei, idr, avccP, avccIdr, hevcP;
+    appendAnnexB(pSmall, slice(0x41, 2 * 1024));
+    appendAnnexB(pLarge, slice(0x41, 60 * 1024));
+    appendAnnexB(pSei, kAud);
+    appendAnnexB(pSei, kSei);
+    appendAnnexB(pSei, slice(0x41, 20 * 1024));
+    appendAnnexB(idr, kAud);
+    appendAnnexB(idr, kSps);
+    appendAnnexB(idr, kPps);
+    appendAnnexB(idr, slice(0x65, 150 * 1024));
+    appendAvcc(avccP, slice(0x41, 20 * 1024));
+    appendAvcc(avccIdr, kSps);
+    appendAvcc(avccIdr, kPps);
+    appendAvcc(avccIdr, slice(0x65, 150 * 1024));
+    appendAnnexB(hevcP, hevcSlice(20 * 1024));
+
+    run("H.264 Annex B P slice",               AV_CODEC_ID_H264, {},     pSmall,  iterations);
+    run("H.264 Annex B P slice (large)",       AV_CODEC_ID_H264, {},     pLarge,  iterations);
+    run("H.264 Annex B AUD+SEI+P",             AV_CODEC_ID_H264, {},     pSei,    iterations);
+    run("H.264 Annex B AUD+SPS+PPS+IDR",       AV_CODEC_ID_H264, {},     idr,     iterations);
+    run("H.264 AVCC P slice",                  AV_CODEC_ID_H264, avcC(), avccP,   iterations);
+    run("H.264 AVCC SPS+PPS+IDR",              AV_CODEC_ID_H264, avcC(), avccIdr, iterations);
+    run("H.265 Annex B TRAIL_R slice",         AV_CODEC_ID_HEVC, {},     hevcP,   iterations);
+    return 0;
+}
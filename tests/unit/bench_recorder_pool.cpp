@@ -0,0 +1,213 @@
+// Shared writer pool (RecorderPool) vs one QThread per recorder, the layout
+// main.cpp used before. Real Mp4RecorderWorker and PacketQueue, recorders in
+// their idle 24/7 state (pre-record buffer only), packets pushed at a fixed
+// frame rate from a few producer threads like the capture side does.
+// Not a ctest test: run it by hand on the target machine (-DBUILD_TESTS=ON).
+//
+//   bench_recorder_pool [streams=300] [fps=25] [seconds=10] [pool_threads=0]
+//                       [packet_kb=12]
+#include "Recording/MP4Recorder.hpp"
+#include "Recording/PacketQueue.hpp"
+#include "Recording/RecorderPool.hpp"
+#include <QCoreApplication>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+struct Params {
+    int streams     = 300;
+    int fps         = 25;
+    int seconds     = 10;
+    int poolThreads = 0;  // 0 = idealThreadCount
+    int packetKb    = 12; // ~2.4 Mbit/s at 25 fps
+    int producers   = 4;
+    int gop         = 50;
+};
+
+struct Usage {
+    double   cpuSec{0};
+    long     ctxSwitches{0};
+};
+
+Usage usage()
+{
+    Usage u;
+#if !defined(_WIN32)
+    rusage r{};
+    getrusage(RUSAGE_SELF, &r);
+    u.cpuSec = r.ru_utime.tv_sec + r.ru_stime.tv_sec +
+               (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1e6;
+    u.ctxSwitches = r.ru_nvcsw + r.ru_nivcsw;
+#endif
+    return u;
+}
+
+long rssKb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::atol(line.c_str() + 6);
+    }
+    return -1;
+}
+
+// One payload shared by every packet: the recorders copy it into their
+// pre-record rings, as they do with demuxed packets
+AVPacketRef makePayload(int bytes)
+{
+    AVPacket *p = av_packet_alloc();
+    if (!p || av_new_packet(p, bytes) < 0) {
+        av_packet_free(&p);
+        return AVPacketRef();
+    }
+    memset(p->data, 0xa5, static_cast<size_t>(bytes));
+    return AVPacketRef(p, [](AVPacket *x) { av_packet_free(&x); });
+}
+
+void produce(const Params &prm, const std::vector<std::shared_ptr<PacketQueue>> &queues,
+             int first, int step, const AVPacketRef &payload)
+{
+    using clock = std::chrono::steady_clock;
+    const auto frame = std::chrono::microseconds(1000000 / prm.fps);
+    const int  frames = prm.fps * prm.seconds;
+    auto next = clock::now();
+    for (int f = 0; f < frames; ++f) {
+        for (size_t i = static_cast<size_t>(first); i < queues.size(); i += static_cast<size_t>(step)) {
+            EncodedVideoPacket p;
+            p.packet    = payload;
+            p.pts       = p.dts = static_cast<int64_t>(f) * 90000 / prm.fps;
+            p.duration  = 90000 / prm.fps;
+            p.key       = (f % prm.gop) == 0;
+            p.time_base = AVRational{1, 90000};
+            queues[i]->push(std::move(p));
+        }
+        next += frame;
+        std::this_thread::sleep_until(next);
+    }
+}
+
+void run(const char *name, const Params &prm, bool pooled)
+{
+    std::vector<std::shared_ptr<PacketQueue>> queues;
+    std::vector<Mp4RecorderWorker*> recorders;
+    for (int i = 0; i < prm.streams; ++i) {
+        auto q = std::make_shared<PacketQueue>(256, PACKET_DROP_GOP);
+        auto *rec = new Mp4RecorderWorker(QString("bench%1").arg(i));
+        rec->setPreBufferingTime(5.0f);
+        rec->setPacketQueue(q);
+        queues.push_back(q);
+        recorders.push_back(rec);
+    }
+
+    // Writer pool, or one thread per recorder with its own counters
+    RecorderPool pool(prm.poolThreads, prm.streams);
+    std::vector<QThread*> threads;
+    std::vector<std::unique_ptr<RecorderThreadStats>> ownStats;
+    for (auto *rec : recorders) {
+        if (pooled) {
+            pool.addRecorder(rec);
+            continue;
+        }
+        auto *t = new QThread();
+        ownStats.push_back(std::make_unique<RecorderThreadStats>());
+        rec->setDrainStats(ownStats.back().get());
+        rec->moveToThread(t);
+        QObject::connect(t, &QThread::finished, rec, &QObject::deleteLater);
+        threads.push_back(t);
+    }
+    if (pooled)
+        pool.start();
+    for (auto *t : threads)
+        t->start();
+
+    const AVPacketRef payload = makePayload(prm.packetKb * 1024);
+    const Usage before = usage();
+    const auto  t0     = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < prm.producers; ++p)
+        producers.emplace_back(produce, std::cref(prm), std::cref(queues), p, prm.producers, std::cref(payload));
+    for (auto &t : producers)
+        t.join();
+    const long rss = rssKb();
+
+    // Let the last batches drain before stopping
+    QThread::msleep(200);
+    const Usage  after = usage();
+    const double wall  = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // Same counters either way: the pool's per-thread ones, or ours
+    sl::json perThread = sl::json::array();
+    if (pooled) {
+        perThread = pool.statsJson()["threads"];
+    } else {
+        for (const auto &s : ownStats)
+            perThread.push_back(s->statsJson());
+    }
+    quint64 drains = 0, packets = 0, waitUs = 0;
+    qint64  waitMax = 0;
+    for (const auto &t : perThread) {
+        drains  += t["drains"].get<quint64>();
+        packets += t["packets"].get<quint64>();
+        waitUs  += t["wait_us_avg"].get<quint64>() * t["drains"].get<quint64>();
+        waitMax  = std::max<qint64>(waitMax, t["wait_us_max"].get<qint64>());
+    }
+    const int threadCount = pooled ? pool.threadCount() : static_cast<int>(threads.size());
+    quint64 dropped = 0;
+    for (const auto &q : queues)
+        dropped += q->statsJson()["dropped"].get<quint64>();
+
+    std::printf("%-14s threads %4d  packets %8llu  dropped %6llu  drains %8llu  "
+                "pkt/drain %5.2f  wait avg %6llu us max %7lld us  cpu %6.2f s (%5.1f%%)  "
+                "ctx switches %8ld  rss %7ld kB\n",
+                name, threadCount,
+                static_cast<unsigned long long>(packets), static_cast<unsigned long long>(dropped),
+                static_cast<unsigned long long>(drains),
+                drains ? static_cast<double>(packets) / drains : 0.0,
+                static_cast<unsigned long long>(drains ? waitUs / drains : 0),
+                static_cast<long long>(waitMax),
+                after.cpuSec - before.cpuSec, 100.0 * (after.cpuSec - before.cpuSec) / wall,
+                after.ctxSwitches - before.ctxSwitches, rss);
+
+    if (pooled) {
+        pool.stop();
+    } else {
+        for (auto *t : threads) {
+            t->quit();
+            t->wait();
+            delete t;
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    Params prm;
+    if (argc > 1) prm.streams     = std::max(1, std::atoi(argv[1]));
+    if (argc > 2) prm.fps         = std::max(1, std::atoi(argv[2]));
+    if (argc > 3) prm.seconds     = std::max(1, std::atoi(argv[3]));
+    if (argc > 4) prm.poolThreads = std::atoi(argv[4]);
+    if (argc > 5) prm.packetKb    = std::max(1, std::atoi(argv[5]));
+
+    std::printf("%d streams, %d fps, %d s, %d KB packets\n",
+                prm.streams, prm.fps, prm.seconds, prm.packetKb);
+    run("per-recorder", prm, false);
+    run("writer-pool", prm, true);
+    return 0;
+}
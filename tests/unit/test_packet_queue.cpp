@@ -0,0 +1,79 @@
+// PacketQueue drop policies. Exit code 0 = pass.
+#include "Recording/PacketQueue.hpp"
+#include <cstdio>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n",               \
+                         __FILE__, __LINE__, #cond);                        \
+            ++failures;                                                     \
+        }                                                                   \
+    } while (0)
+
+static bool pushPacket(PacketQueue &q, bool key)
+{
+    EncodedVideoPacket p;
+    p.key = key;
+    return q.push(std::move(p));
+}
+
+static size_t drainAll(PacketQueue &q)
+{
+    return q.drain([](EncodedVideoPacket &) {});
+}
+
+// Full queue: a dropped P-frame drops everything up to the next keyframe
+static void testDropNonKeySkipsRestOfGop()
+{
+    PacketQueue q(2, PACKET_DROP_NONKEY); // capacity 2
+    CHECK(pushPacket(q, true));
+    CHECK(pushPacket(q, false));
+    CHECK(!pushPacket(q, false));         // full: P dropped
+
+    drainAll(q);                          // room again
+    CHECK(!pushPacket(q, false));         // refers to the dropped P
+    CHECK(!pushPacket(q, false));
+    CHECK(q.depth() == 0);
+    CHECK(pushPacket(q, true));           // next GOP accepted
+    CHECK(pushPacket(q, false));
+    CHECK(q.statsJson()["dropped"].get<uint64_t>() == 3);
+}
+
+static void testDropGopSkipsRestOfGop()
+{
+    PacketQueue q(2, PACKET_DROP_GOP);
+    CHECK(pushPacket(q, true));
+    CHECK(pushPacket(q, false));
+    CHECK(!pushPacket(q, false));
+    drainAll(q);
+    CHECK(!pushPacket(q, false));
+    CHECK(pushPacket(q, true));
+}
+
+// Producer that must not block (reactor): a full queue drops even a keyframe
+static void testNonBlockingProducerDrops()
+{
+    PacketQueue q(2, PACKET_BLOCK);
+    q.setProducerCanBlock(false);
+    CHECK(pushPacket(q, true));
+    CHECK(pushPacket(q, false));
+    CHECK(!pushPacket(q, true));
+    drainAll(q);
+    CHECK(!pushPacket(q, false));
+    CHECK(pushPacket(q, true));
+}
+
+int main()
+{
+    testDropNonKeySkipsRestOfGop();
+    testDropGopSkipsRestOfGop();
+    testNonBlockingProducerDrops();
+    if (failures)
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+    else
+        std::printf("test_packet_queue: all checks passed\n");
+    return failures ? 1 : 0;
+}